@@ -0,0 +1,221 @@
+/*
+ * Cache simulator for the allocator's metadata accesses, see cachesim.h
+ *
+ * Every level, the TLB included, is an array of sets of tags with a
+ * last-use stamp each; a miss replaces the way used longest ago.  Tags
+ * are stored plus one so that 0 marks an empty way.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include "cachesim.h"
+
+struct level {
+    size_t sets;
+    size_t ways;
+    size_t shift;             /* log2 of the bytes one tag covers */
+    uint64_t *tags;           /* sets * ways tags, plus one */
+    uint64_t *stamps;         /* when each way was last used */
+};
+
+/* private global variables */
+static struct level l1, l2, tlb;
+static struct cachesim_stats stats[CACHESIM_OPS];
+static int cur_op = CACHESIM_OTHER;
+static bool enabled = false;
+static uint64_t now;              /* stamp of the current access */
+
+/* Page numbering: page of the address -> order in which it was first touched */
+static uint64_t *page_keys;       /* page plus one, 0 if the slot is empty */
+static uint64_t *page_ids;
+static size_t page_slots;         /* a power of 2 */
+static size_t page_count;
+static size_t page_shift;
+static uint64_t last_page, last_id;
+
+/*
+ * log2_of - log2 of x, or -1 if x is not a power of 2
+ */
+static int log2_of(size_t x) {
+    int n = 0;
+
+    if (x == 0 || (x & (x - 1)) != 0)
+        return -1;
+    while ((x >> n) != 1)
+        n++;
+    return n;
+}
+
+/*
+ * level_init - size and zero level l, false if the geometry is not usable
+ */
+static bool level_init(struct level *l, size_t size, size_t ways, size_t unit) {
+    int shift = log2_of(unit);
+
+    if (shift < 0 || ways == 0 || size % (ways * unit) != 0 || log2_of(size / (ways * unit)) < 0)
+        return false;
+    free(l->tags);
+    free(l->stamps);
+    l->sets = size / (ways * unit);
+    l->ways = ways;
+    l->shift = shift;
+    l->tags = calloc(l->sets * ways, sizeof(uint64_t));
+    l->stamps = calloc(l->sets * ways, sizeof(uint64_t));
+    if (l->tags == NULL || l->stamps == NULL) {
+        fprintf(stderr, "ERROR.  Couldn't allocate the simulated caches\n");
+        exit(1);
+    }
+    return true;
+}
+
+/*
+ * level_access - look addr up in level l, filling it in on a miss; true on a hit
+ */
+static bool level_access(struct level *l, uint64_t addr) {
+    uint64_t tag = (addr >> l->shift) + 1;
+    size_t set = (size_t) (addr >> l->shift) & (l->sets - 1);
+    uint64_t *tags = l->tags + set * l->ways;
+    uint64_t *stamps = l->stamps + set * l->ways;
+    size_t i, victim = 0;
+
+    for (i = 0; i < l->ways; i++) {
+        if (tags[i] == tag) {
+            stamps[i] = now;
+            return true;
+        }
+        if (stamps[i] < stamps[victim])
+            victim = i;
+    }
+    tags[victim] = tag;
+    stamps[victim] = now;
+    return false;
+}
+
+/*
+ * page_id - the number of the page of addr in first-touch order
+ */
+static uint64_t page_id(uintptr_t addr) {
+    uint64_t page = (addr >> page_shift) + 1;
+    size_t i, old_slots;
+    uint64_t *old_keys, *old_ids;
+
+    if (page == last_page)
+        return last_id;
+    if (2 * (page_count + 1) > page_slots) {     /* keep the table at most half full */
+        old_keys = page_keys;
+        old_ids = page_ids;
+        old_slots = page_slots;
+        page_slots = old_slots ? 2 * old_slots : 1024;
+        page_keys = calloc(page_slots, sizeof(uint64_t));
+        page_ids = calloc(page_slots, sizeof(uint64_t));
+        if (page_keys == NULL || page_ids == NULL) {
+            fprintf(stderr, "ERROR.  Couldn't allocate the simulated page table\n");
+            exit(1);
+        }
+        for (i = 0; i < old_slots; i++) {
+            if (old_keys[i] != 0) {
+                size_t j = (size_t) (old_keys[i] * 0x9E3779B97F4A7C15ull >> 32) & (page_slots - 1);
+                while (page_keys[j] != 0)
+                    j = (j + 1) & (page_slots - 1);
+                page_keys[j] = old_keys[i];
+                page_ids[j] = old_ids[i];
+            }
+        }
+        free(old_keys);
+        free(old_ids);
+    }
+    i = (size_t) (page * 0x9E3779B97F4A7C15ull >> 32) & (page_slots - 1);
+    while (page_keys[i] != 0 && page_keys[i] != page)
+        i = (i + 1) & (page_slots - 1);
+    if (page_keys[i] == 0) {
+        page_keys[i] = page;
+        page_ids[i] = page_count++;
+    }
+    last_page = page;
+    last_id = page_ids[i];
+    return last_id;
+}
+
+/*
+ * cachesim_init - set up the hierarchy, false if the geometry is not usable
+ */
+bool cachesim_init(const struct cachesim_config *config) {
+    int shift = log2_of(config->page);
+
+    if (shift < 0 || config->line > config->page ||
+        !level_init(&l1, config->l1_size, config->l1_ways, config->line) ||
+        !level_init(&l2, config->l2_size, config->l2_ways, config->line) ||
+        !level_init(&tlb, config->tlb_entries * config->page, config->tlb_ways, config->page))
+        return false;
+    page_shift = shift;
+    cachesim_reset();
+    return true;
+}
+
+/*
+ * cachesim_reset - empty every cache and the page numbering, zero the counters
+ */
+void cachesim_reset(void) {
+    struct level *levels[] = { &l1, &l2, &tlb };
+    size_t i;
+
+    for (i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+        if (levels[i]->tags != NULL) {
+            memset(levels[i]->tags, 0, levels[i]->sets * levels[i]->ways * sizeof(uint64_t));
+            memset(levels[i]->stamps, 0, levels[i]->sets * levels[i]->ways * sizeof(uint64_t));
+        }
+    }
+    if (page_keys != NULL)
+        memset(page_keys, 0, page_slots * sizeof(uint64_t));
+    page_count = 0;
+    last_page = 0;
+    now = 0;
+    cur_op = CACHESIM_OTHER;
+    memset(stats, 0, sizeof(stats));
+}
+
+/*
+ * cachesim_enable - simulate accesses from now on or ignore them
+ */
+void cachesim_enable(bool on) {
+    enabled = on && l1.tags != NULL;
+}
+
+/*
+ * cachesim_op - charge the accesses from now on to op
+ */
+void cachesim_op(int op) {
+    cur_op = op;
+    stats[op].ops++;
+}
+
+/*
+ * cachesim_access - one metadata access of a word at addr: through the TLB, then L1, then L2 on a miss
+ */
+void cachesim_access(const void *addr) {
+    uint64_t id, phys;
+    struct cachesim_stats *s = &stats[cur_op];
+
+    if (!enabled)
+        return;
+    now++;
+    s->accesses++;
+    id = page_id((uintptr_t) addr);
+    phys = (id << page_shift) | ((uintptr_t) addr & (((uint64_t) 1 << page_shift) - 1));
+    if (!level_access(&tlb, phys))
+        s->tlb_misses++;
+    if (!level_access(&l1, phys)) {
+        s->l1_misses++;
+        if (!level_access(&l2, phys))
+            s->l2_misses++;
+    }
+}
+
+/*
+ * cachesim_stats - the counters of op since the last cachesim_reset
+ */
+struct cachesim_stats cachesim_stats(int op) {
+    return stats[op];
+}
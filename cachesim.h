@@ -0,0 +1,58 @@
+/*
+ * Cache simulator for the allocator's metadata accesses
+ *
+ * mm.c built with CACHESIM hands every GET, PUT and PUT_ADDRESS to
+ * cachesim_access.  Each access goes through a TLB and two levels of
+ * set-associative LRU cache, L1 then L2.  Misses are charged to the
+ * operation last named by cachesim_op.  Pages are numbered in the order
+ * they are first touched and the caches see those numbers, so the
+ * counts do not depend on where mmap put the heap: the same trace on
+ * the same build gives the same misses on any machine.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Geometry of the simulated hierarchy, sizes in bytes */
+struct cachesim_config {
+    size_t line;          /* cache line */
+    size_t l1_size;
+    size_t l1_ways;
+    size_t l2_size;
+    size_t l2_ways;
+    size_t page;          /* TLB page */
+    size_t tlb_entries;
+    size_t tlb_ways;
+};
+
+/* 32 KiB 8-way L1, 1 MiB 16-way L2, 64-entry 4-way TLB of 4 KiB pages */
+#define CACHESIM_DEFAULTS { 64, 32 << 10, 8, 1 << 20, 16, 4096, 64, 4 }
+
+/* What the accesses are charged to */
+enum { CACHESIM_OTHER, CACHESIM_MALLOC, CACHESIM_FREE, CACHESIM_REALLOC, CACHESIM_OPS };
+
+struct cachesim_stats {
+    size_t ops;           /* cachesim_op calls naming this operation */
+    size_t accesses;
+    size_t l1_misses;
+    size_t l2_misses;
+    size_t tlb_misses;
+};
+
+/* Set up the hierarchy, false if the geometry is not usable
+   (sets must come out a power of 2) */
+bool cachesim_init(const struct cachesim_config *config);
+
+/* Empty every cache and zero the counters */
+void cachesim_reset(void);
+
+/* Simulate accesses from now on or ignore them, off at first */
+void cachesim_enable(bool on);
+
+/* Charge the accesses from now on to op, counting one more of it */
+void cachesim_op(int op);
+
+/* One metadata access of a word at addr */
+void cachesim_access(const void *addr);
+
+/* The counters of op since the last cachesim_reset */
+struct cachesim_stats cachesim_stats(int op);
@@ -103,6 +103,13 @@
  */
 #define MAX_HEAP_SIZE (1ull*(1ull<<40)) /* 1 TB */
 
+/*********** Parameters controlling sparse memory version of heap **********/
+/*
+ * Maximum heap size in bytes with mem_set_sparse: only address space,
+ * the pages written are kept in a hash
+ */
+#define MAX_SPARSE_HEAP_SIZE (16ull*(1ull<<40)) /* 16 TB */
+
 
 /***************** Parameters for looking up reference throughput *********/
 /*
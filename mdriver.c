@@ -26,6 +26,7 @@
 #include "fcyc.h"
 #include "config.h"
 #include "stree.h"
+#include "cachesim.h"
 
 /**********************
  * Constants and macros
@@ -40,6 +41,26 @@
 #define REF_ONLY 0
 #endif
 
+/* Cache coloring micro-benchmark (-C) */
+#define COLOR_BLOCKS  64          /* blocks whose first lines are touched */
+#define COLOR_SIZE  6000          /* bytes per block, a page run with slack for coloring */
+#define COLOR_ROUNDS 1000         /* passes over the blocks per measurement */
+#define CACHE_LINE    64
+#define L1_SETS       64          /* sets of a 32 KiB 8-way L1, i.e. lines per 4 KiB way */
+
+/* Lifetime predictor (-L): a block is short-lived if it is freed within
+   1/LIFE_SPLIT of the trace's requests */
+#define LIFE_SPLIT   64
+
+/* Resident heap (-M): samples per trace, and how much of a block is touched */
+#define RSS_SAMPLES 1000
+#define RSS_TOUCH   (64 << 20)
+
+/* Pool benchmark (-B): the sizes that dominate the bdd traces */
+#define POOL_SIZES    2
+static const size_t pool_sizes[POOL_SIZES] = { 24, 32 };
+static const size_t pool_aligns[POOL_SIZES] = { 8, 16 };
+
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned long)(p)) % ALIGNMENT) == 0)
 
@@ -83,6 +104,7 @@ typedef struct {
     enum { ALLOC, FREE, REALLOC } type; /* type of request */
     long index;                         /* index for free() to use later */
     size_t size;                        /* byte size of alloc/realloc request */
+    int lifetime;                       /* MM_LIVE_* hint for an alloc, set by -L */
 } traceop_t;
 
 /* Holds the information for one trace file */
@@ -121,6 +143,12 @@ typedef struct {
 
     /* defined only for the student malloc package */
     double util;       /* space utilization for this trace (always 0 for libc) */
+    double sys_secs;   /* time memlib charged for one run of the trace (-k, -K) */
+    double rss_peak;   /* largest resident heap bytes seen (-M) */
+    double rss_util;   /* live bytes over resident bytes, averaged over the run (-M) */
+    double copy_bytes; /* bytes realloc copied in the first correctness run (MEM_TRAFFIC) */
+    double fill_bytes; /* bytes the driver wrote into blocks in that run (MEM_TRAFFIC) */
+    struct cachesim_stats cache[CACHESIM_OPS]; /* metadata misses of the utilization run by operation (-S) */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
@@ -162,6 +190,29 @@ static bool onetime_flag = false;
 static bool tab_mode = false;     /* Print output as tab-separated fields */
 static size_t maxfill = MAXFILL;
 
+/* What mm_init is told about the trace's peak data bytes (set by -P and -R) */
+typedef enum { PEAK_NONE, PEAK_HINT, PEAK_RESERVE } peak_mode_t;
+static peak_mode_t peak_mode = PEAK_NONE;
+
+/* Restart the heap with mm_reset where the driver can (cleared by -I) */
+static bool use_reset = true;
+
+/* Pass the predicted lifetime of each block to mm_malloc_hint (set by -L) */
+static bool use_lifetime = false;
+
+/* Charge mem_sbrk and first page touches with memlib's cost model (set by -k and -K) */
+static bool use_costs = false;
+
+/* Track the resident heap pages during the utilization run (set by -M) */
+static bool use_rss = false;
+
+/* Simulate the caches on mm.c's metadata accesses during the utilization run (set by -S and -X) */
+static bool use_cachesim = false;
+static struct cachesim_config cache_config = CACHESIM_DEFAULTS;
+
+/* Keep the heap in this file and map it again halfway through every validity run (set by -F) */
+static const char *heap_file = NULL;
+
 /* by default, no timeouts */
 static int set_timeout = 0;
 
@@ -208,6 +259,8 @@ static void randomize_block(trace_t *trace, int index);
 static trace_t *read_trace(stats_t *stats, const char *tracedir,
                            const char *filename);
 static void reinit_trace(trace_t *trace);
+static void predict_lifetimes(trace_t *trace);
+static void *trace_malloc(const traceop_t *op);
 static void free_trace(trace_t *trace);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
@@ -216,12 +269,34 @@ static void eval_libc_speed(void *ptr);
 
 /* Routines for evaluating correctnes, space utilization, and speed
    of the student's malloc package in mm.c */
-static bool eval_mm_valid(trace_t *trace, range_set_t *ranges);
-static double eval_mm_util(trace_t *trace, int tracenum);
+static bool eval_mm_valid(trace_t *trace, range_set_t *ranges, bool reset);
+static bool remap_heap(trace_t *trace, range_set_t *ranges, int opnum);
+static bool eval_mm_regions(trace_t *trace, range_set_t *ranges);
+static double eval_mm_util(trace_t *trace, int tracenum, stats_t *stats);
 static void eval_mm_speed(void *ptr);
 
+/* Micro-benchmarks of the mm.c malloc package */
+static void eval_color(void);
+static void color_touch(void *ptr);
+
+/* Arena comparison (-A) */
+static void eval_arena(trace_t *trace);
+static void arena_free_speed(void *ptr);
+static void arena_bulk_speed(void *ptr);
+
+/* Huge page comparison (-H) */
+static void eval_huge(trace_t *trace);
+static size_t anon_huge_kb(void);
+
+/* Pool comparison (-B) */
+static void eval_pool(trace_t *trace);
+static void pool_malloc_speed(void *ptr);
+static void pool_pool_speed(void *ptr);
+
 /* Various helper routines */
+static bool init_mm(const trace_t *trace, bool reset);
 static void printresults(int n, stats_t *stats, sum_stats_t *sumstats);
+static void printcache(int n, stats_t *stats);
 static void usage(char *prog);
 static void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
     __attribute__((format(printf, 3,4)));
@@ -271,9 +346,19 @@ static void run_tests(int num_tracefiles, const char *tracedir,
         } else {
             if (verbose > 1)
                 printf("Checking mm_malloc for correctness, ");
-            mm_stats[i].valid =
-                /* Do 2 tests, since may fail to reinitialize properly */
-                eval_mm_valid(trace, ranges) && eval_mm_valid(trace, ranges);
+#ifdef MEM_TRAFFIC
+            mem_traffic_reset();
+#endif
+            mm_stats[i].valid = eval_mm_valid(trace, ranges, false);
+#ifdef MEM_TRAFFIC
+            mm_stats[i].copy_bytes = mem_traffic(MEM_KIND_REALLOC).copied;
+            mm_stats[i].fill_bytes = mem_traffic(MEM_KIND_DRIVER).written;
+#endif
+            /* Do 2 tests, since may fail to reinitialize properly;
+               the second one starts from mm_reset */
+            mm_stats[i].valid = mm_stats[i].valid && eval_mm_valid(trace, ranges, true);
+            /* A payload in a second heap region must pass the same checks */
+            mm_stats[i].valid = mm_stats[i].valid && eval_mm_regions(trace, ranges);
 
             if (onetime_flag) {
                 free_trace(trace);
@@ -283,7 +368,9 @@ static void run_tests(int num_tracefiles, const char *tracedir,
         if (mm_stats[i].valid) {
             if (verbose > 1)
                 printf("efficiency, ");
-            mm_stats[i].util = eval_mm_util(trace, i);
+            double sys_start = mem_sys_secs();
+            mm_stats[i].util = eval_mm_util(trace, i, &mm_stats[i]);
+            mm_stats[i].sys_secs = mem_sys_secs() - sys_start;
             speed_params->trace = trace;
             speed_params->ranges = ranges;
             if (verbose > 1)
@@ -329,6 +416,10 @@ int main(int argc, char **argv)
     speed_t speed_params;      /* input parameters to the xx_speed routines */
 
     bool run_libc = false;     /* If set, run libc malloc (set by -l) */
+    bool run_color = false;    /* If set, run the cache coloring benchmark (set by -C) */
+    bool run_arena = false;    /* If set, compare frees with arenas (set by -A) */
+    bool run_huge = false;     /* If set, compare 4 KiB pages with huge pages (set by -H) */
+    bool run_pool = false;     /* If set, compare mm_malloc with pools (set by -B) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util;
@@ -356,7 +447,7 @@ int main(int argc, char **argv)
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hOVlDT")) != EOF) {
+    while ((c = getopt(argc, argv, "d:f:c:s:t:v:k:X:F:hOVlDTCPRIABLKMHSE")) != EOF) {
         switch (c) {
 
             case 'f': /* Use one specific trace file only (relative to curr dir) */
@@ -406,6 +497,85 @@ int main(int argc, char **argv)
                 tab_mode = true;
                 break;
 
+            case 'C': /* Run the cache coloring micro-benchmark only */
+                run_color = true;
+                break;
+
+            case 'P': /* Pass each trace's peak to mm_hint_peak */
+                peak_mode = PEAK_HINT;
+                break;
+
+            case 'R': /* Reserve each trace's peak with mm_reserve */
+                peak_mode = PEAK_RESERVE;
+                break;
+
+            case 'I': /* Always restart the heap with mm_init */
+                use_reset = false;
+                break;
+
+            case 'A': /* Compare per-object frees with one arena per trace */
+                run_arena = true;
+                break;
+
+            case 'B': /* Compare mm_malloc with pools for the bdd sizes */
+                run_pool = true;
+                break;
+
+            case 'L': /* Hint every malloc with its predicted lifetime */
+                use_lifetime = true;
+                break;
+
+            case 'k': { /* Spin for <sbrk ns>,<page ns> per mem_sbrk and first page touch */
+                long sbrk_ns = 0, page_ns = 0;
+                if (sscanf(optarg, "%ld,%ld", &sbrk_ns, &page_ns) < 1) {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                mem_set_costs(sbrk_ns, page_ns, false);
+                use_costs = true;
+                break;
+            }
+
+            case 'K': /* Really mprotect the pages mem_sbrk adds */
+                mem_set_costs(0, 0, true);
+                use_costs = true;
+                break;
+
+            case 'H': /* Compare each trace's throughput with and without huge pages */
+                run_huge = true;
+                break;
+
+            case 'M': /* Report the resident heap next to the brk-based utilization */
+                use_rss = true;
+                break;
+
+            case 'E': /* Keep the heap in memlib's page hash, so traces may span terabytes */
+                mem_set_sparse(true);
+                break;
+
+            case 'F': /* Keep the heap in a file, and map it again halfway through each validity run */
+                heap_file = optarg;
+                mem_set_file(heap_file);
+                break;
+
+            case 'S': /* Count the cache misses of mm.c's metadata accesses */
+                use_cachesim = true;
+                break;
+
+            case 'X': { /* -S on caches of <L1 KB>,<L1 ways>,<L2 KB>,<L2 ways>,<TLB entries>,<TLB ways> */
+                size_t l1_kb, l2_kb;
+                if (sscanf(optarg, "%zu,%zu,%zu,%zu,%zu,%zu", &l1_kb, &cache_config.l1_ways,
+                           &l2_kb, &cache_config.l2_ways, &cache_config.tlb_entries,
+                           &cache_config.tlb_ways) != 6) {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                cache_config.l1_size = l1_kb << 10;
+                cache_config.l2_size = l2_kb << 10;
+                use_cachesim = true;
+                break;
+            }
+
             case 'h': /* Print this message */
                 usage(argv[0]);
                 exit(0);
@@ -417,6 +587,26 @@ int main(int argc, char **argv)
     }
 #endif /* !REF_ONLY */
 
+    if (mem_sparse() && (run_color || run_arena || run_pool || run_huge)) {
+        fprintf(stderr, "-E cannot be combined with -C, -A, -B or -H, which use heap memory directly\n");
+        exit(1);
+    }
+
+    if (heap_file != NULL && mem_sparse()) {
+        fprintf(stderr, "-F cannot be combined with -E, a heap file is not sparse\n");
+        exit(1);
+    }
+
+    if (run_color) {
+        eval_color();
+        exit(0);
+    }
+
+    if (use_cachesim && !cachesim_init(&cache_config)) {
+        fprintf(stderr, "The cache geometry of -X must give every level a power of 2 of sets\n");
+        exit(1);
+    }
+
     if (num_global_tracefiles == 0) {
         int i;
         for (i = 0; default_tracefiles[i]; i++)
@@ -427,6 +617,42 @@ int main(int argc, char **argv)
         init_random_data();
     }
 
+    if (run_arena) {
+        stats_t arena_stats;
+        printf("%-30s %8s %10s %10s %10s %10s\n", "trace", "ops",
+               "free Kops", "arena Kops", "free KB", "arena KB");
+        for (i = 0; i < num_global_tracefiles; i++) {
+            trace_t *trace = read_trace(&arena_stats, tracedir, global_tracefiles[i]);
+            eval_arena(trace);
+            free_trace(trace);
+        }
+        exit(0);
+    }
+
+    if (run_huge) {
+        stats_t huge_stats;
+        printf("%-30s %8s %10s %10s %10s %10s %10s\n", "trace", "ops",
+               "4K Kops", "THP Kops", "4K KB", "THP KB", "in THP KB");
+        for (i = 0; i < num_global_tracefiles; i++) {
+            trace_t *trace = read_trace(&huge_stats, tracedir, global_tracefiles[i]);
+            eval_huge(trace);
+            free_trace(trace);
+        }
+        exit(0);
+    }
+
+    if (run_pool) {
+        stats_t pool_stats;
+        printf("%-30s %8s %10s %10s %10s %10s\n", "trace", "ops",
+               "malloc Kops", "pool Kops", "malloc KB", "pool KB");
+        for (i = 0; i < num_global_tracefiles; i++) {
+            trace_t *trace = read_trace(&pool_stats, tracedir, global_tracefiles[i]);
+            eval_pool(trace);
+            free_trace(trace);
+        }
+        exit(0);
+    }
+
     /* Initialize the timeout */
     if (set_timeout > 0) {
         signal(SIGALRM, timeout_handler);
@@ -514,6 +740,10 @@ int main(int argc, char **argv)
             printf("\nResults for mm malloc:\n");
             printresults(num_global_tracefiles, mm_stats, &global_mm_sum_stats);
             printf("\n");
+            if (use_cachesim) {
+                printcache(num_global_tracefiles, mm_stats);
+                printf("\n");
+            }
         }
     }
 
@@ -692,12 +922,17 @@ static bool add_range(range_set_t *ranges, char *lo, size_t size,
         return false;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
-        (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of one heap region */
+    int region = mem_region_of(lo);
+    if (region < 0) {
         malloc_error(trace, opnum,
-                     "Payload (%p:%p) lies outside heap (%p:%p)",
-                     lo, hi, mem_heap_lo(), mem_heap_hi());
+                     "Payload (%p:%p) lies outside every heap region", lo, hi);
+        return false;
+    }
+    if (mem_region_of(hi) != region) {
+        malloc_error(trace, opnum,
+                     "Payload (%p:%p) runs past the end of heap region %d (%p:%p)",
+                     lo, hi, region, mem_region_lo(region), mem_region_hi(region));
         return false;
     }
 
@@ -821,6 +1056,9 @@ static void randomize_block(trace_t *traces, int index) {
     // NOTE: It would be nice to also fill in at end of block, but
     // this gets messy with REALLOC
 
+#ifdef MEM_TRAFFIC
+    int kind = mem_traffic_kind(MEM_KIND_DRIVER);
+#endif
     for(i = 0; i < fsize; i++) {
         mem_write(&block[i],
                   random_data[(base + i) % RANDOM_DATA_LEN],
@@ -831,6 +1069,9 @@ static void randomize_block(trace_t *traces, int index) {
                   random_data[(base + i) % RANDOM_DATA_LEN],
                   sizeof(randint_t));
     }
+#ifdef MEM_TRAFFIC
+    mem_traffic_kind(kind);
+#endif
 }
 
 static bool check_index(const trace_t *trace, int opnum, int index, int realloc) {
@@ -868,6 +1109,9 @@ static bool check_index(const trace_t *trace, int opnum, int index, int realloc)
     base = trace->block_rand_base[index];
 
     // NOTE: It's expensive to do this one byte at a time.
+#ifdef MEM_TRAFFIC
+    int kind = mem_traffic_kind(MEM_KIND_DRIVER);
+#endif
     for(i = 0; i < fsize; i++) {
         if (mem_read(&block[i], sizeof(randint_t)) != random_data[(base + i) % RANDOM_DATA_LEN]) {
             if (firstgarbled == -1) firstgarbled = i;
@@ -880,6 +1124,9 @@ static bool check_index(const trace_t *trace, int opnum, int index, int realloc)
             ngarbled++;
         }
     }
+#ifdef MEM_TRAFFIC
+    mem_traffic_kind(kind);
+#endif
     if (ngarbled != 0) {
         malloc_error(trace, opnum, "block %d has %d garbled %s%s, "
                      "starting at byte %zu", index, ngarbled, randint_t_name,
@@ -988,6 +1235,9 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
 
+    if (use_lifetime)
+        predict_lifetimes(trace);
+
     /* fill in the stats */
     strcpy(stats->filename, trace->filename);
     stats->weight = trace->weight;
@@ -996,6 +1246,87 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     return trace;
 }
 
+/*
+ * Alloc requests of one size, sorted by size for predict_lifetimes
+ */
+typedef struct {
+    size_t size;
+    int life;     /* requests until the block is freed */
+} life_t;
+
+static int life_cmp(const void *a, const void *b)
+{
+    size_t x = ((const life_t *) a)->size, y = ((const life_t *) b)->size;
+    return (x > y) - (x < y);
+}
+
+/*
+ * predict_lifetimes - the offline lifetime predictor behind -L.  A block
+ *    lives from its alloc to its free, or to the end of the trace if it is
+ *    never freed; a realloc does not end its life.  A size is short-lived
+ *    if most of its blocks live for less than num_ops / LIFE_SPLIT
+ *    requests, and every alloc of that size is then hinted MM_LIVE_SHORT.
+ */
+static void predict_lifetimes(trace_t *trace)
+{
+    int *born, *life, i, j, k, n = 0, shorts;
+    life_t *sizes;
+    int split = trace->num_ops / LIFE_SPLIT;
+
+    born = malloc(trace->num_ids * sizeof(*born));
+    life = malloc(trace->num_ops * sizeof(*life));
+    sizes = malloc(trace->num_ops * sizeof(*sizes));
+    if (born == NULL || life == NULL || sizes == NULL)
+        unix_error("malloc in predict_lifetimes failed");
+
+    for (i = 0; i < trace->num_ops; i++) {
+        traceop_t *op = &trace->ops[i];
+        op->lifetime = MM_LIVE_LONG;
+        if (op->type == ALLOC) {
+            born[op->index] = i;
+            life[i] = trace->num_ops - i;
+        } else if (op->type == FREE && op->index >= 0) {
+            life[born[op->index]] = i - born[op->index];
+        }
+    }
+    for (i = 0; i < trace->num_ops; i++)
+        if (trace->ops[i].type == ALLOC) {
+            sizes[n].size = trace->ops[i].size;
+            sizes[n++].life = life[i];
+        }
+    qsort(sizes, n, sizeof(*sizes), life_cmp);
+
+    /* one entry per size, its life set to 1 for short-lived sizes */
+    for (i = 0, k = 0; i < n; i = j, k++) {
+        for (j = i, shorts = 0; j < n && sizes[j].size == sizes[i].size; j++)
+            shorts += sizes[j].life < split;
+        sizes[k].size = sizes[i].size;
+        sizes[k].life = 2 * shorts > j - i;
+    }
+    for (i = 0; i < trace->num_ops; i++)
+        if (trace->ops[i].type == ALLOC) {
+            life_t key = { trace->ops[i].size, 0 };
+            life_t *found = bsearch(&key, sizes, k, sizeof(*sizes), life_cmp);
+            if (found->life)
+                trace->ops[i].lifetime = MM_LIVE_SHORT;
+        }
+
+    free(born);
+    free(life);
+    free(sizes);
+}
+
+/*
+ * trace_malloc - mm_malloc for an alloc request, through mm_malloc_hint
+ *    if -L was given
+ */
+static void *trace_malloc(const traceop_t *op)
+{
+    if (use_lifetime)
+        return mm_malloc_hint(op->size, op->lifetime);
+    return mm_malloc(op->size);
+}
+
 /*
  * reinit_trace - get the trace ready for another run.
  */
@@ -1027,7 +1358,7 @@ static void free_trace(trace_t *trace)
 /*
  * eval_mm_valid - Check the mm malloc package for correctness
  */
-static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
+static bool eval_mm_valid(trace_t *trace, range_set_t *ranges, bool reset)
 {
     int i;
     int index;
@@ -1036,12 +1367,11 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
     char *oldp;
     char *p;
 
-    /* Reset the heap and free any records in the range list */
-    mem_reset_brk();
+    /* Free any records in the range list */
     reinit_trace(trace);
 
-    /* Call the mm package's init function */
-    if (!mm_init()) {
+    /* Reset the heap and call the mm package's init function */
+    if (!init_mm(trace, reset)) {
         malloc_error(trace, 0, "mm_init failed.");
         return false;
     }
@@ -1051,6 +1381,10 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
         index = trace->ops[i].index;
         size = trace->ops[i].size;
 
+        /* With -F, go on with the second half of the trace where a restart would */
+        if (heap_file != NULL && i == trace->num_ops / 2 && !remap_heap(trace, ranges, i))
+            return false;
+
         if (debug_mode == DBG_EXPENSIVE) {
             range_t *r;
                         
@@ -1074,7 +1408,7 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
             case ALLOC: /* mm_malloc */
 
                 /* Call the student's malloc */
-                if ((p = mm_malloc(size)) == NULL) {
+                if ((p = trace_malloc(&trace->ops[i])) == NULL) {
                     malloc_error(trace, i, "mm_malloc failed.");
                     return false;
                 }
@@ -1160,19 +1494,128 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
     return true;
 }
 
+/*
+ * remap_heap - map the heap file again at a new address, as a program that
+ *    opens it after a restart would, and have mm_attach take it over; the
+ *    blocks then move with it, in trace->blocks and in the range set
+ */
+static bool remap_heap(trace_t *trace, range_set_t *ranges, int opnum)
+{
+    char *old_lo = mem_heap_lo();
+    ptrdiff_t delta;
+    range_t *r;
+    int j;
+
+    if (!mem_remap()) {
+        malloc_error(trace, opnum, "mem_remap couldn't map the heap file again.");
+        return false;
+    }
+    if (!mm_attach()) {
+        malloc_error(trace, opnum, "mm_attach failed, mm.c must be built with -DPERSIST (mdriver-persist).");
+        return false;
+    }
+    delta = (char *) mem_heap_lo() - old_lo;
+    for (j = 0; j < trace->num_ids; j++) {
+        if (trace->blocks[j] != NULL)
+            trace->blocks[j] += delta;
+    }
+
+    /* the tree is keyed by address, so it is built again */
+    tree_free(ranges->lo_tree, NULL);
+    ranges->lo_tree = tree_new();
+    for (r = ranges->list; r; r = r->next) {
+        r->lo += delta;
+        r->hi += delta;
+        tree_insert(ranges->lo_tree, (long unsigned) r->lo, (void *) r);
+    }
+
+    if (!mm_checkheap(__LINE__)) {
+        malloc_error(trace, opnum, "mm_checkheap returned false after the heap was mapped again\n");
+        return false;
+    }
+    return true;
+}
+
+/*
+ * eval_mm_regions - allocate a page from a second heap region and check that
+ *    a payload at its end passes add_range, that the region's bounds and
+ *    mem_total_size count that page, and that ids of no region are refused;
+ *    the next init_mm drops the region again
+ */
+static bool eval_mm_regions(trace_t *trace, range_set_t *ranges)
+{
+    size_t page = mem_pagesize();
+    size_t total = mem_total_size();
+    char *lo;
+    int id;
+
+    if ((id = mem_region_create(page)) < 0 ||
+        (lo = mem_region_sbrk(id, page)) == (void *) -1) {
+        malloc_error(trace, 0, "Could not allocate a page from a second heap region.");
+        return false;
+    }
+    if (mem_region_lo(id) != lo || mem_region_hi(id) != lo + page - 1 ||
+        mem_region_size(id) != page || mem_total_size() != total + page) {
+        malloc_error(trace, 0, "Region %d (%p:%p) does not hold the page at %p.",
+                     id, mem_region_lo(id), mem_region_hi(id), lo);
+        return false;
+    }
+    if (!add_range(ranges, lo + page - ALIGNMENT, ALIGNMENT, trace, 0, 0))
+        return false;
+    remove_range(ranges, lo + page - ALIGNMENT);
+    if (mem_region_of(lo + page) == id || mem_region_lo(MEM_REGIONS) != NULL ||
+        mem_region_size(-1) != 0) {
+        malloc_error(trace, 0, "Region %d reaches past its break, or a region id out of range was accepted.", id);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * touch_size - how many bytes of a block of size bytes touch_block touches
+ */
+static size_t touch_size(size_t size)
+{
+    return (size > RSS_TOUCH) ? RSS_TOUCH : size;
+}
+
+/*
+ * touch_block - write one byte in every page of the first RSS_TOUCH bytes of
+ *     a block, so its pages are resident as if the program used it
+ */
+static void touch_block(char *p, size_t size)
+{
+    size_t page = mem_pagesize();
+    size_t i;
+
+    if (p == NULL || size == 0)
+        return;
+    size = touch_size(size);
+    for (i = 0; i < size; i += page - ((size_t) (p + i) & (page - 1)))
+        mem_write(p + i, 0, 1);
+    mem_write(p + size - 1, 0, 1);
+}
+
 /*
  * eval_mm_util - Evaluate the space utilization of the student's package
  *   The idea is to remember the high water mark "hwm" of the heap for
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the
  *   size of the heap in bytes after running the student's malloc
- *   package on the trace. Note that our implementation of mem_sbrk()
+ *   package on the trace, summed over all heap regions. Note that our implementation of mem_sbrk()
  *   doesn't allow the students to decrement the brk pointer, so brk
  *   is always the high water mark of the heap.
  *
  *   A higher number is better: 1 is optimal.
+ *
+ *   With -M the payloads are touched like a program would, and the
+ *   resident heap is sampled RSS_SAMPLES times over the trace into
+ *   stats: its peak, and the live bytes over resident bytes summed
+ *   over the samples, i.e. averaged over the run. Blocks are only
+ *   touched up to RSS_TOUCH bytes, and only that much of them counts
+ *   as live there.
  */
-static double eval_mm_util(trace_t *trace, int tracenum)
+static double eval_mm_util(trace_t *trace, int tracenum, stats_t *stats)
 {
     int i;
     int index;
@@ -1183,12 +1626,25 @@ static double eval_mm_util(trace_t *trace, int tracenum)
     size_t heap_size = 0;
     char *p;
     char *newp, *oldp;
+    int rss_every = trace->num_ops / RSS_SAMPLES + 1;
+    size_t rss, rss_peak = 0;
+    size_t touched_size = 0;      /* live bytes touch_block made resident */
+    double rss_live = 0, rss_sum = 0;
 
     reinit_trace(trace);
 
+    /* the pages the validity runs touched are not this run's */
+    if (use_rss)
+        mem_release(mem_heap_lo(), mem_heapsize());
+
+    /* cold caches, mm_init is charged to CACHESIM_OTHER */
+    if (use_cachesim) {
+        cachesim_reset();
+        cachesim_enable(true);
+    }
+
     /* initialize the heap and the mm malloc package */
-    mem_reset_brk();
-    if (!mm_init())
+    if (!init_mm(trace, false))
         app_error("trace %d: mm_init failed in eval_mm_util", tracenum);
 
     for (i = 0;  i < trace->num_ops;  i++) {
@@ -1197,8 +1653,10 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             case ALLOC: /* mm_alloc */
                 index = trace->ops[i].index;
                 size = trace->ops[i].size;
+                if (use_cachesim)
+                    cachesim_op(CACHESIM_MALLOC);
 
-                if ((p = mm_malloc(size)) == NULL) {
+                if ((p = trace_malloc(&trace->ops[i])) == NULL) {
                     app_error("trace %d: mm_malloc failed in eval_mm_util",
                               tracenum);
                 }
@@ -1206,8 +1664,11 @@ static double eval_mm_util(trace_t *trace, int tracenum)
                 /* Remember region and size */
                 trace->blocks[index] = p;
                 trace->block_sizes[index] = size;
+                if (use_rss)
+                    touch_block(p, size);
 
                 total_size += size;
+                touched_size += touch_size(size);
                 break;
 
             case REALLOC: /* mm_realloc */
@@ -1216,6 +1677,8 @@ static double eval_mm_util(trace_t *trace, int tracenum)
                 oldsize = trace->block_sizes[index];
 
                 oldp = trace->blocks[index];
+                if (use_cachesim)
+                    cachesim_op(CACHESIM_REALLOC);
                 if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0) {
                     app_error("trace %d: mm_realloc failed in eval_mm_util",
                               tracenum);
@@ -1224,8 +1687,11 @@ static double eval_mm_util(trace_t *trace, int tracenum)
                 /* Remember region and size */
                 trace->blocks[index] = newp;
                 trace->block_sizes[index] = newsize;
+                if (use_rss)
+                    touch_block(newp, newsize);
 
                 total_size += (newsize - oldsize);
+                touched_size += touch_size(newsize) - touch_size(oldsize);
                 break;
 
             case FREE: /* mm_free */
@@ -1238,9 +1704,12 @@ static double eval_mm_util(trace_t *trace, int tracenum)
                     p = trace->blocks[index];
                 }
 
+                if (use_cachesim)
+                    cachesim_op(CACHESIM_FREE);
                 mm_free(p);
 
                 total_size -= size;
+                touched_size -= touch_size(size);
                 break;
 
             default:
@@ -1251,9 +1720,28 @@ static double eval_mm_util(trace_t *trace, int tracenum)
         /* update the high-water mark */
         max_total_size = (total_size > max_total_size) ?
             total_size : max_total_size;
-        heap_size = mem_heapsize();
+        heap_size = mem_total_size();
         max_heap_size = (heap_size > max_heap_size) ?
             heap_size : max_heap_size;
+
+        /* sample the resident heap */
+        if (use_rss && (i % rss_every == 0 || i == trace->num_ops - 1)) {
+            rss = mem_resident();
+            rss_peak = (rss > rss_peak) ? rss : rss_peak;
+            rss_live += touched_size;
+            rss_sum += rss;
+        }
+    }
+
+    if (use_cachesim) {
+        cachesim_enable(false);
+        for (i = 0; i < CACHESIM_OPS; i++)
+            stats->cache[i] = cachesim_stats(i);
+    }
+
+    if (use_rss) {
+        stats->rss_peak = rss_peak;
+        stats->rss_util = (rss_sum == 0) ? 0 : rss_live / rss_sum;
     }
 
 #if !REF_ONLY
@@ -1271,14 +1759,14 @@ static double eval_mm_util(trace_t *trace, int tracenum)
 static void eval_mm_speed(void *ptr)
 {
     int i, index;
-    size_t size, newsize;
+    size_t newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
     reinit_trace(trace);
 
-    /* Reset the heap and initialize the mm package */
-    mem_reset_brk();
-    if (!mm_init())
+    /* Reset the heap and initialize the mm package; the heap has been
+       through mm_init already, so mm_reset can restore that state */
+    if (!init_mm(trace, true))
         app_error("mm_init failed in eval_mm_speed");
 
     /* Interpret each trace request */
@@ -1287,8 +1775,7 @@ static void eval_mm_speed(void *ptr)
 
             case ALLOC: /* mm_malloc */
                 index = trace->ops[i].index;
-                size = trace->ops[i].size;
-                if ((p = mm_malloc(size)) == NULL)
+                if ((p = trace_malloc(&trace->ops[i])) == NULL)
                     app_error("mm_malloc error in eval_mm_speed");
                 trace->blocks[index] = p;
                 break;
@@ -1368,6 +1855,384 @@ static bool eval_libc_valid(trace_t *trace)
     return true;
 }
 
+/*
+ * init_mm - start an empty heap: mem_reset_brk and mm_init, or mm_reset
+ *    if reset is set and -I was not given; then pass the trace's peak on
+ *    as -P or -R asked
+ */
+static bool init_mm(const trace_t *trace, bool reset)
+{
+    if (reset && use_reset) {
+        if (!mm_reset())
+            return false;
+    } else {
+        mem_reset_brk();
+        if (!mm_init())
+            return false;
+    }
+    switch (peak_mode) {
+        case PEAK_HINT:
+            mm_hint_peak(trace->data_bytes);
+            break;
+        case PEAK_RESERVE:
+            return mm_reserve(trace->data_bytes);
+        case PEAK_NONE:
+            break;
+    }
+    return true;
+}
+
+/*
+ * eval_color - allocate COLOR_BLOCKS blocks of COLOR_SIZE bytes and time
+ *    read-modify-writes of their first lines.  When the blocks all start
+ *    at the same offset in their pages, those lines map to one L1 set and
+ *    keep evicting each other; spread over many sets they all stay cached.
+ */
+static void eval_color(void)
+{
+    char *blocks[COLOR_BLOCKS];
+    bool used[L1_SETS] = { false };
+    int i, sets = 0;
+    double secs;
+
+    mem_init();
+    if (!mm_init())
+        app_error("mm_init failed in eval_color");
+    for (i = 0; i < COLOR_BLOCKS; i++) {
+        if ((blocks[i] = mm_malloc(COLOR_SIZE)) == NULL)
+            app_error("mm_malloc failed in eval_color");
+        memset(blocks[i], 0, CACHE_LINE);
+        size_t set = ((size_t) blocks[i] / CACHE_LINE) % L1_SETS;
+        if (!used[set]) {
+            used[set] = true;
+            sets++;
+        }
+    }
+
+    secs = fsec(color_touch, blocks);
+    printf("%d blocks of %d bytes: first lines in %d of %d L1 sets, %.2f ns per access\n",
+           COLOR_BLOCKS, COLOR_SIZE, sets, L1_SETS,
+           secs * 1e9 / ((double) COLOR_ROUNDS * COLOR_BLOCKS));
+
+    for (i = 0; i < COLOR_BLOCKS; i++)
+        mm_free(blocks[i]);
+    mem_deinit();
+}
+
+/*
+ * color_touch - the loop timed by eval_color
+ */
+static void color_touch(void *ptr)
+{
+    char **blocks = ptr;
+    int r, i;
+
+    for (r = 0; r < COLOR_ROUNDS; r++)
+        for (i = 0; i < COLOR_BLOCKS; i++)
+            (*(volatile long *) blocks[i])++;
+}
+
+/*
+ * eval_arena - replay the trace twice, treating it as one request scope:
+ *    once with mm_malloc, mm_realloc and a mm_free per object (blocks
+ *    still live at the end are freed one by one), and once from a single
+ *    arena, ignoring frees and destroying the arena at the end.  Prints
+ *    the throughput and the final heap size of both.
+ */
+static void eval_arena(trace_t *trace)
+{
+    speed_t params = { trace, NULL };
+    double free_secs, bulk_secs;
+    size_t free_heap, bulk_heap;
+
+    mem_init();
+    free_secs = fsec(arena_free_speed, &params);
+    free_heap = mem_total_size();
+    bulk_secs = fsec(arena_bulk_speed, &params);
+    bulk_heap = mem_total_size();
+    mem_deinit();
+
+    printf("%-30s %8d %10.0f %10.0f %10zu %10zu\n", trace->filename,
+           trace->num_ops, trace->num_ops / free_secs / 1e3,
+           trace->num_ops / bulk_secs / 1e3, free_heap / 1024, bulk_heap / 1024);
+}
+
+/*
+ * eval_huge - time the trace like eval_mm_speed on a heap of 4 KiB pages,
+ *    then on one that memlib aligns to huge pages and mm.c grows in whole
+ *    huge pages.  Prints the throughput and the heap size of both, and how
+ *    much of the process the kernel backed with huge pages in the second.
+ */
+static void eval_huge(trace_t *trace)
+{
+    speed_t params = { trace, NULL };
+    double secs[2];
+    size_t heap[2];
+    size_t huge_kb = 0;
+    int on;
+
+    for (on = 0; on < 2; on++) {
+        mem_set_hugepages(on);
+        mem_init();
+        if (!init_mm(trace, false))     /* a snapshot of this heap for mm_reset */
+            app_error("mm_init failed in eval_huge");
+        secs[on] = fsec(eval_mm_speed, &params);
+        heap[on] = mem_total_size();
+        if (on)
+            huge_kb = anon_huge_kb();
+        mem_deinit();
+    }
+    mem_set_hugepages(false);
+
+    printf("%-30s %8d %10.0f %10.0f %10zu %10zu %10zu\n", trace->filename,
+           trace->num_ops, trace->num_ops / secs[0] / 1e3,
+           trace->num_ops / secs[1] / 1e3, heap[0] / 1024, heap[1] / 1024, huge_kb);
+}
+
+/*
+ * anon_huge_kb - the anonymous memory of the process in huge pages, 0 if
+ *    the kernel does not say
+ */
+static size_t anon_huge_kb(void)
+{
+    FILE *fp = fopen("/proc/self/smaps_rollup", "r");
+    char line[MAXLINE];
+    size_t kb = 0;
+
+    if (fp == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), fp) != NULL)
+        if (sscanf(line, "AnonHugePages: %zu kB", &kb) == 1)
+            break;
+    fclose(fp);
+    return kb;
+}
+
+/*
+ * arena_free_speed - the per-object run timed by eval_arena
+ */
+static void arena_free_speed(void *ptr)
+{
+    trace_t *trace = ((speed_t *)ptr)->trace;
+    int i, index;
+    char *p;
+
+    reinit_trace(trace);
+    if (!init_mm(trace, false))
+        app_error("mm_init failed in arena_free_speed");
+
+    for (i = 0; i < trace->num_ops; i++) {
+        index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
+            case ALLOC:
+                if ((p = mm_malloc(trace->ops[i].size)) == NULL)
+                    app_error("mm_malloc error in arena_free_speed");
+                trace->blocks[index] = p;
+                break;
+
+            case REALLOC:
+                p = mm_realloc(trace->blocks[index], trace->ops[i].size);
+                if (p == NULL && trace->ops[i].size != 0)
+                    app_error("mm_realloc error in arena_free_speed");
+                trace->blocks[index] = p;
+                break;
+
+            case FREE:
+                if (index >= 0) {
+                    mm_free(trace->blocks[index]);
+                    trace->blocks[index] = NULL;
+                }
+                break;
+
+            default:
+                app_error("Nonexistent request type in arena_free_speed");
+        }
+    }
+    for (i = 0; i < trace->num_ids; i++)
+        mm_free(trace->blocks[i]);
+}
+
+/*
+ * arena_bulk_speed - the arena run timed by eval_arena; a realloc takes
+ *    a new object and copies the old payload over
+ */
+static void arena_bulk_speed(void *ptr)
+{
+    trace_t *trace = ((speed_t *)ptr)->trace;
+    struct mm_arena *arena;
+    int i, index;
+    size_t size, oldsize;
+    char *p;
+
+    reinit_trace(trace);
+    if (!init_mm(trace, false))
+        app_error("mm_init failed in arena_bulk_speed");
+    if ((arena = mm_arena_create()) == NULL)
+        app_error("mm_arena_create failed in arena_bulk_speed");
+
+    for (i = 0; i < trace->num_ops; i++) {
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        switch (trace->ops[i].type) {
+            case ALLOC:
+                if ((p = mm_arena_malloc(arena, size)) == NULL)
+                    app_error("mm_arena_malloc error in arena_bulk_speed");
+                trace->blocks[index] = p;
+                trace->block_sizes[index] = size;
+                break;
+
+            case REALLOC:
+                if (size == 0) {
+                    trace->blocks[index] = NULL;
+                    break;
+                }
+                if ((p = mm_arena_malloc(arena, size)) == NULL)
+                    app_error("mm_arena_malloc error in arena_bulk_speed");
+                oldsize = trace->block_sizes[index];
+                if (trace->blocks[index] != NULL)
+                    memcpy(p, trace->blocks[index], size < oldsize ? size : oldsize);
+                trace->blocks[index] = p;
+                trace->block_sizes[index] = size;
+                break;
+
+            case FREE:
+                break;
+
+            default:
+                app_error("Nonexistent request type in arena_bulk_speed");
+        }
+    }
+    mm_arena_destroy(arena);
+}
+
+/*
+ * Which pool_sizes entry each id of the trace timed by eval_pool
+ * belongs to, or -1 for ids the pool runs skip (-2 while eval_pool has
+ * not seen the id allocated yet)
+ */
+static int *pool_class;
+static int pool_ops;
+
+/*
+ * eval_pool - replay the requests of the trace on ids that are allocated
+ *    with one of pool_sizes, always the same one, and never reallocated,
+ *    once with mm_malloc
+ *    and mm_free and once with one pool per size.  Prints the throughput
+ *    and the final heap size of both.
+ */
+static void eval_pool(trace_t *trace)
+{
+    speed_t params = { trace, NULL };
+    double malloc_secs, pool_secs;
+    size_t malloc_heap, pool_heap;
+    int i, k;
+
+    if ((pool_class = malloc(trace->num_ids * sizeof(*pool_class))) == NULL)
+        unix_error("pool_class malloc in eval_pool failed");
+    for (i = 0; i < trace->num_ids; i++)
+        pool_class[i] = -2;
+    for (i = 0; i < trace->num_ops; i++) {
+        long index = trace->ops[i].index;
+        if (trace->ops[i].type == ALLOC) {
+            for (k = 0; k < POOL_SIZES && trace->ops[i].size != pool_sizes[k]; k++)
+                ;
+            if (k == POOL_SIZES || (pool_class[index] != -2 && pool_class[index] != k))
+                pool_class[index] = -1;     /* skipped for good, even if a later alloc fits a pool */
+            else
+                pool_class[index] = k;
+        } else if (trace->ops[i].type == REALLOC) {
+            pool_class[index] = -1;
+        }
+    }
+    for (i = 0; i < trace->num_ids; i++)
+        if (pool_class[i] == -2)
+            pool_class[i] = -1;
+    pool_ops = 0;
+    for (i = 0; i < trace->num_ops; i++)
+        if (trace->ops[i].index >= 0 && pool_class[trace->ops[i].index] >= 0)
+            pool_ops++;
+
+    mem_init();
+    malloc_secs = fsec(pool_malloc_speed, &params);
+    malloc_heap = mem_total_size();
+    pool_secs = fsec(pool_pool_speed, &params);
+    pool_heap = mem_total_size();
+    mem_deinit();
+    free(pool_class);
+
+    if (pool_ops == 0) {
+        printf("%-30s %8d %10s %10s %10s %10s\n", trace->filename, 0,
+               "-", "-", "-", "-");
+        return;
+    }
+    printf("%-30s %8d %10.0f %10.0f %10zu %10zu\n", trace->filename,
+           pool_ops, pool_ops / malloc_secs / 1e3, pool_ops / pool_secs / 1e3,
+           malloc_heap / 1024, pool_heap / 1024);
+}
+
+/*
+ * pool_malloc_speed - the mm_malloc run timed by eval_pool
+ */
+static void pool_malloc_speed(void *ptr)
+{
+    trace_t *trace = ((speed_t *)ptr)->trace;
+    int i, index;
+    char *p;
+
+    reinit_trace(trace);
+    if (!init_mm(trace, false))
+        app_error("mm_init failed in pool_malloc_speed");
+
+    for (i = 0; i < trace->num_ops; i++) {
+        index = trace->ops[i].index;
+        if (index < 0 || pool_class[index] < 0)
+            continue;
+        if (trace->ops[i].type == ALLOC) {
+            if ((p = mm_malloc(trace->ops[i].size)) == NULL)
+                app_error("mm_malloc error in pool_malloc_speed");
+            trace->blocks[index] = p;
+        } else if (trace->ops[i].type == FREE) {
+            mm_free(trace->blocks[index]);
+            trace->blocks[index] = NULL;
+        }
+    }
+    for (i = 0; i < trace->num_ids; i++)
+        mm_free(trace->blocks[i]);
+}
+
+/*
+ * pool_pool_speed - the pool run timed by eval_pool
+ */
+static void pool_pool_speed(void *ptr)
+{
+    trace_t *trace = ((speed_t *)ptr)->trace;
+    struct mm_pool *pools[POOL_SIZES];
+    int i, k, index;
+    char *p;
+
+    reinit_trace(trace);
+    if (!init_mm(trace, false))
+        app_error("mm_init failed in pool_pool_speed");
+    for (k = 0; k < POOL_SIZES; k++)
+        if ((pools[k] = mm_pool_create(pool_sizes[k], pool_aligns[k])) == NULL)
+            app_error("mm_pool_create failed in pool_pool_speed");
+
+    for (i = 0; i < trace->num_ops; i++) {
+        index = trace->ops[i].index;
+        if (index < 0 || pool_class[index] < 0)
+            continue;
+        if (trace->ops[i].type == ALLOC) {
+            if ((p = mm_pool_alloc(pools[pool_class[index]])) == NULL)
+                app_error("mm_pool_alloc error in pool_pool_speed");
+            trace->blocks[index] = p;
+        } else if (trace->ops[i].type == FREE) {
+            mm_pool_free(pools[pool_class[index]], trace->blocks[index]);
+        }
+    }
+    for (k = 0; k < POOL_SIZES; k++)
+        mm_pool_destroy(pools[k]);
+}
+
 /*
  * eval_libc_speed - This is the function that is used by fcyc() to
  *    measure the running time of the libc malloc package on the set
@@ -1433,18 +2298,31 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
     double sumsecs = 0;
     double sumops  = 0;
     double sumutil = 0;
+    double sumrss = 0;
     int sum_perf_weight = 0;
     int sum_util_weight = 0;
 
     char wstr;
     char *tabstr;
 
+#ifdef MEM_TRAFFIC
+    const char *traffic_tab = "copy B/op\tfill B/op\t";
+    const char *traffic_cols = "copy B/op fill B/op ";
+#else
+    const char *traffic_tab = "";
+    const char *traffic_cols = "";
+#endif
+
     /* Print the individual results for each trace */
     if (tab_mode) {
-        printf("valid\tthru?\tutil?\tutil\tops\tmsecs\tKops\ttrace\n");
+        printf("valid\tthru?\tutil?\tutil\tops\tmsecs\tKops\t%s%s%s%strace\n",
+               use_costs ? "sys ms\t" : "", use_rss ? "rss KB\trss util\t" : "", traffic_tab,
+               use_cachesim ? "L1/op\tL2/op\tTLB/op\t" : "");
     } else {
-        printf("  %5s  %6s %7s%8s%8s  %s\n",
-               "valid", "util", "ops", "msecs", "Kops", "trace");
+        printf("  %5s  %6s %7s%8s%8s  %s%s%s%s%s\n",
+               "valid", "util", "ops", "msecs", "Kops", use_costs ? " sys ms " : "",
+               use_rss ? "  rss KB rss util " : "", traffic_cols,
+               use_cachesim ? " L1/op  L2/op TLB/op " : "", "trace");
     }
     for (i=0; i < n; i++) {
         if (stats[i].valid) {
@@ -1507,6 +2385,44 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
                     printf("%8s%10s%7s ", "--", "--", "--");
             }
 
+            /* System time charged by memlib for one run */
+            if (use_costs) {
+                if (tab_mode)
+                    printf("%.3f\t", stats[i].sys_secs * 1000.0);
+                else
+                    printf("%7.3f ", stats[i].sys_secs * 1000.0);
+            }
+
+            /* Resident heap */
+            if (use_rss) {
+                if (tab_mode)
+                    printf("%.0f\t%.1f\t", stats[i].rss_peak / 1024, stats[i].rss_util * 100.0);
+                else
+                    printf("%8.0f %7.1f%% ", stats[i].rss_peak / 1024, stats[i].rss_util * 100.0);
+            }
+
+#ifdef MEM_TRAFFIC
+            /* Bytes moved per op in the first correctness run */
+            if (tab_mode)
+                printf("%.1f\t%.1f\t", stats[i].copy_bytes / stats[i].ops, stats[i].fill_bytes / stats[i].ops);
+            else
+                printf("%9.1f %9.1f ", stats[i].copy_bytes / stats[i].ops, stats[i].fill_bytes / stats[i].ops);
+#endif
+
+            /* Metadata misses per op, mm_init included */
+            if (use_cachesim) {
+                double l1 = 0, l2 = 0, tlb = 0;
+                for (int op = 0; op < CACHESIM_OPS; op++) {
+                    l1 += stats[i].cache[op].l1_misses;
+                    l2 += stats[i].cache[op].l2_misses;
+                    tlb += stats[i].cache[op].tlb_misses;
+                }
+                if (tab_mode)
+                    printf("%.3f\t%.3f\t%.3f\t", l1 / stats[i].ops, l2 / stats[i].ops, tlb / stats[i].ops);
+                else
+                    printf("%6.2f %6.2f %6.2f ", l1 / stats[i].ops, l2 / stats[i].ops, tlb / stats[i].ops);
+            }
+
             printf("%s\n", stats[i].filename);
 
             if (stats[i].weight == WALL || stats[i].weight == WPERF)
@@ -1519,6 +2435,7 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
             {
                 sum_util_weight += 1;
                 sumutil += stats[i].util;
+                sumrss += stats[i].rss_util;
             }
         }
         else {
@@ -1560,6 +2477,9 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
                    sumops,
                    sumsecs * 1000.0,
                    tput);
+            if (use_rss && sumrss != 0)
+                printf("Average resident utilization = %.1f%%\n",
+                       sumrss / sum_util_weight * 100.0);
         }
 
         /* Record the summary statistics so we can compare libc and
@@ -1792,6 +2712,40 @@ static double measure_ref_throughput() {
 }
 
 
+/*
+ * printcache - prints the metadata cache misses per operation of each kind, as
+ *              L1/L2/TLB misses per malloc, per free and per realloc
+ */
+static void printcache(int n, stats_t *stats)
+{
+    static const char *names[CACHESIM_OPS] = { "init", "malloc", "free", "realloc" };
+    size_t accesses = 0;
+    int i, op;
+
+    printf("Metadata cache misses per operation, L1/L2/TLB (%zu KB %zu-way L1, %zu KB %zu-way L2, "
+           "%zu-entry %zu-way TLB):\n",
+           cache_config.l1_size >> 10, cache_config.l1_ways, cache_config.l2_size >> 10,
+           cache_config.l2_ways, cache_config.tlb_entries, cache_config.tlb_ways);
+    for (op = CACHESIM_MALLOC; op < CACHESIM_OPS; op++)
+        printf(tab_mode ? "%s\t" : "%21s ", names[op]);
+    printf("trace\n");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        for (op = CACHESIM_OTHER; op < CACHESIM_OPS; op++)
+            accesses += stats[i].cache[op].accesses;
+        for (op = CACHESIM_MALLOC; op < CACHESIM_OPS; op++) {
+            struct cachesim_stats *c = &stats[i].cache[op];
+            double ops = c->ops ? c->ops : 1;
+            printf(tab_mode ? "%.3f/%.3f/%.3f\t" : "%6.2f/%6.2f/%6.2f ",
+                   c->l1_misses / ops, c->l2_misses / ops, c->tlb_misses / ops);
+        }
+        printf("%s\n", stats[i].filename);
+    }
+    if (accesses == 0)
+        printf("No metadata accesses seen: mm.c was built without -DCACHESIM, run mdriver-sim\n");
+}
+
 /*
  * usage - Explain the command line arguments
  */
@@ -1809,5 +2763,20 @@ static void usage(char *prog)
     fprintf(stderr, "\t-v <i>     Set Verbosity Level to <i>\n");
     fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
     fprintf(stderr, "\t-T         Print diagnostics in tab mode\n");
+    fprintf(stderr, "\t-C         Run the cache coloring micro-benchmark only\n");
+    fprintf(stderr, "\t-P         Tell mm_hint_peak the peak data bytes of each trace\n");
+    fprintf(stderr, "\t-R         mm_reserve the peak data bytes of each trace up front\n");
+    fprintf(stderr, "\t-I         Restart the heap with mm_init instead of mm_reset\n");
+    fprintf(stderr, "\t-A         Compare per-object frees with one arena per trace\n");
+    fprintf(stderr, "\t-B         Compare mm_malloc with pools for the bdd object sizes\n");
+    fprintf(stderr, "\t-L         Pass predicted lifetimes to mm_malloc_hint\n");
+    fprintf(stderr, "\t-H         Compare throughput on 4 KiB pages and on transparent huge pages\n");
+    fprintf(stderr, "\t-M         Report peak resident heap and time-averaged resident utilization\n");
+    fprintf(stderr, "\t-E         Keep the heap sparse, in memlib's page hash (mdriver-emu)\n");
+    fprintf(stderr, "\t-F <file>  Keep the heap in <file>, map it again halfway through each check (mdriver-persist)\n");
+    fprintf(stderr, "\t-S         Count the cache and TLB misses of mm.c's metadata accesses (mdriver-sim)\n");
+    fprintf(stderr, "\t-X <l1>,<w>,<l2>,<w>,<tlb>,<w> -S with L1 and L2 of so many KB and ways, TLB of so many entries and ways\n");
+    fprintf(stderr, "\t-k <s>,<p> Charge s ns per mem_sbrk and p ns per new heap page, add a sys ms column\n");
+    fprintf(stderr, "\t-K         Make mem_sbrk really mprotect the heap, sys ms is the time in those calls\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file\n");
 }
@@ -9,75 +9,396 @@
 #include <assert.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 
 #include "memlib.h"
 #include "config.h"
 
+#define MEM_NT_BYTES (1 << 20)     /* copies and fills this big skip the cache (non-temporal stores) */
+#define MEM_FILE_STEP (1 << 20)    /* a heap file grows in steps of this many bytes */
+
+/*
+ * A region is one reserved range of address space with its own break.
+ * Region 0 is the heap: mem_sbrk, mem_heap_lo and friends work on it.
+ */
+struct mem_region {
+    unsigned char *lo;                      /* Starting address of the region */
+    unsigned char *brk;                     /* Current position of its break */
+    unsigned char *max;                     /* Maximum allowable address */
+    unsigned char *touched;                 /* End of the pages the break has passed since the region was emptied */
+    bool huge;                              /* aligned to and advised for huge pages */
+};
+
 /* private global variables */
-static unsigned char *heap;                 /* Starting address of heap */
-static unsigned char *mem_brk;              /* Current position of break */
-static unsigned char *mem_max_addr;         /* Maximum allowable heap address */
+static struct mem_region regions[MEM_REGIONS];
+static int num_regions;                     /* regions in use, 0 before mem_init */
 
-/* 
- * mem_init - initialize the memory system model
+/* Cost model, set by mem_set_costs */
+static long cost_sbrk_ns;                   /* charged for every mem_sbrk */
+static long cost_page_ns;                   /* charged for every page the break passes for the first time */
+static bool cost_syscalls;                  /* really mprotect the pages instead, and let them fault */
+static double sys_secs;                     /* time charged so far */
+
+/* Regions aligned to huge pages and advised MADV_HUGEPAGE, set by mem_set_hugepages */
+static bool huge_pages;
+
+#ifdef MEM_TRAFFIC
+/* Bytes moved by kind, see mem_traffic_kind */
+static struct mem_traffic traffic[MEM_KINDS];
+static int traffic_kind = MEM_KIND_OTHER;
+#endif
+
+/* Sparse regions, set by mem_set_sparse: their bytes live in a hash of the pages written so far */
+#define SPARSE_PAGE 4096
+struct sparse_page {
+    uintptr_t addr;                         /* first address the page holds */
+    struct sparse_page *next;               /* next page in the same bucket */
+    unsigned char data[SPARSE_PAGE];
+};
+static bool sparse;
+static struct sparse_page **sparse_table;   /* chains of pages, sparse_buckets of them */
+static size_t sparse_buckets;               /* a power of 2 */
+static size_t sparse_pages;                 /* pages in the table */
+static struct sparse_page *sparse_last;     /* page of the last access, looked at first */
+#define SPARSE_TLB 1024
+static struct sparse_page *sparse_tlb[SPARSE_TLB];  /* pages found lately, by page number mod SPARSE_TLB */
+
+/* File-backed heap, set by mem_set_file: region 0 is a shared mapping of the file. The file is kept
+   at least as long as the heap while it is mapped, and exactly as long when it is let go of */
+static const char *heap_file;
+static int heap_fd = -1;                    /* the file while it is mapped */
+static size_t heap_file_size;               /* its length */
+
+static void mem_pick_copies(void);
+static void sparse_drop(uintptr_t lo, uintptr_t hi);
+
+/*
+ * region_map - reserve size bytes of address space for region r; with huge_pages
+ *              the region starts on a huge page boundary and is advised MADV_HUGEPAGE
  */
-void mem_init(){
+static bool region_map(struct mem_region *r, size_t size){
+    size_t slack = huge_pages && !sparse ? MEM_HUGEPAGE : 0;
     unsigned char* addr = mmap(NULL,                                        /* start*/
-                               MAX_HEAP_SIZE,                               /* length */
-                               PROT_READ | PROT_WRITE,                      /* permissions */
+                               size + slack,                                /* length */
+                               cost_syscalls || sparse ? PROT_NONE : PROT_READ | PROT_WRITE, /* permissions */
                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, /* flags */
                                -1,                                          /* fd */
                                0);                                          /* offset */
+    unsigned char *lo;
+
     if (addr == MAP_FAILED) {
+        return false;
+    }
+    if (slack != 0) {                       /* trim the mapping to the aligned part */
+        lo = (unsigned char *) (((uintptr_t) addr + slack - 1) & ~(uintptr_t) (slack - 1));
+        if (lo > addr)
+            munmap(addr, lo - addr);
+        if (lo + size < addr + size + slack)
+            munmap(lo + size, addr + slack - lo);
+        madvise(lo, size, MADV_HUGEPAGE);
+        addr = lo;
+    }
+    r->lo = r->brk = r->touched = addr;
+    r->max = addr + size;
+    r->huge = slack != 0;
+    return true;
+}
+
+/*
+ * file_map - map heap_file as the heap r: MAX_HEAP_SIZE bytes of address space on a MEM_HUGEPAGE
+ *              boundary, so blks keep their alignment wherever it lands, with the break at the end
+ *              of the file, so a heap left there comes back as it was
+ */
+static bool file_map(struct mem_region *r){
+    size_t slack = MEM_HUGEPAGE;
+    struct stat st;
+    unsigned char *addr, *lo;
+    int fd = open(heap_file, O_RDWR | O_CREAT, 0600);
+
+    if (fd < 0) {
+        return false;
+    }
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size > MAX_HEAP_SIZE) {
+        close(fd);
+        return false;
+    }
+    addr = mmap(NULL, MAX_HEAP_SIZE + slack, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    lo = (unsigned char *) (((uintptr_t) addr + slack - 1) & ~(uintptr_t) (slack - 1));
+    if (mmap(lo, MAX_HEAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED | MAP_NORESERVE, fd, 0) == MAP_FAILED) {
+        munmap(addr, MAX_HEAP_SIZE + slack);
+        close(fd);
+        return false;
+    }
+    if (lo > addr)
+        munmap(addr, lo - addr);
+    if (lo + MAX_HEAP_SIZE < addr + MAX_HEAP_SIZE + slack)
+        munmap(lo + MAX_HEAP_SIZE, addr + slack - lo);
+    r->lo = lo;
+    r->brk = r->touched = lo + st.st_size;
+    r->max = lo + MAX_HEAP_SIZE;
+    r->huge = false;
+    heap_fd = fd;
+    heap_file_size = st.st_size;
+    return true;
+}
+
+/*
+ * file_resize - make the heap file size bytes long
+ */
+static void file_resize(size_t size){
+    if (ftruncate(heap_fd, size) != 0) {
+        fprintf(stderr, "FAILURE.  ftruncate couldn't resize the heap file %s\n", heap_file);
+        exit(1);
+    }
+    heap_file_size = size;
+}
+
+/*
+ * region_unmap - give the address space of region r back
+ */
+static void region_unmap(struct mem_region *r){
+    if (sparse)
+        sparse_drop((uintptr_t) r->lo, (uintptr_t) r->max);
+    if (munmap(r->lo, r->max - r->lo) != 0) {
+        fprintf(stderr, "FAILURE.  munmap couldn't deallocate heap space\n");
+        exit(1);
+    }
+}
+
+/*
+ * mem_clock - monotonic time in seconds
+ */
+static double mem_clock(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * mem_charge - charge the cost of moving the break of r up to brk: a spin of
+ *              cost_sbrk_ns plus cost_page_ns per page it passes for the first
+ *              time (as if each of them gets touched), or with cost_syscalls the
+ *              time of an mprotect that makes the pages accessible; their page
+ *              faults then happen for real where they are first touched
+ */
+static void mem_charge(struct mem_region *r, unsigned char *brk){
+    uintptr_t page = mem_pagesize();
+    unsigned char *from = (unsigned char *) ((uintptr_t) r->brk & ~(page - 1));
+    unsigned char *to = (unsigned char *) (((uintptr_t) brk + page - 1) & ~(page - 1));
+    double start = mem_clock();
+    double cost;
+
+    if (cost_syscalls) {
+        if (to > from && mprotect(from, to - from, PROT_READ | PROT_WRITE) != 0) {
+            fprintf(stderr, "FAILURE.  mprotect couldn't commit heap pages\n");
+            exit(1);
+        }
+        sys_secs += mem_clock() - start;
+    } else {
+        cost = (cost_sbrk_ns + (to > r->touched ? (to - r->touched) / page : 0) * cost_page_ns) * 1e-9;
+        while (mem_clock() - start < cost)
+            ;
+        sys_secs += cost;
+    }
+    if (to > r->touched) {
+        r->touched = to;
+    }
+}
+
+/*
+ * mem_set_costs - turn the cost model on (or off, with all zeros); applies to regions mapped from now on
+ */
+void mem_set_costs(long sbrk_ns, long page_ns, bool syscalls){
+    cost_sbrk_ns = sbrk_ns;
+    cost_page_ns = page_ns;
+    cost_syscalls = syscalls;
+}
+
+/*
+ * mem_set_hugepages - back regions mapped from now on with transparent huge pages or not
+ */
+void mem_set_hugepages(bool on){
+    huge_pages = on;
+}
+
+/*
+ * mem_hugepage_size - the huge page size the heap is aligned to, 0 if it is not
+ */
+size_t mem_hugepage_size(void){
+    return (num_regions > 0 && regions[0].huge) ? MEM_HUGEPAGE : 0;
+}
+
+/*
+ * mem_set_sparse - keep the bytes of regions mapped from now on in the page hash or not
+ */
+void mem_set_sparse(bool on){
+    sparse = on;
+}
+
+/*
+ * mem_sparse - true if the regions are sparse
+ */
+bool mem_sparse(void){
+    return sparse;
+}
+
+/*
+ * mem_set_file - back the heap mapped by the next mem_init with the file at path, or not with NULL
+ */
+void mem_set_file(const char *path){
+    heap_file = path;
+}
+
+/*
+ * mem_remap - map the heap file again at a new address, as a process that opens it after a restart
+ *              would find it, and drop the old mapping; false if there is no file or it cannot be mapped
+ */
+bool mem_remap(void){
+    struct mem_region old = regions[0];
+    int old_fd = heap_fd;
+
+    if (heap_fd < 0)
+        return false;
+    file_resize(old.brk - old.lo);
+    if (!file_map(&regions[0])) {                  /* the old mapping is still there, so the address is new */
+        regions[0] = old;
+        heap_fd = old_fd;
+        return false;
+    }
+    munmap(old.lo, old.max - old.lo);
+    close(old_fd);
+    return true;
+}
+
+/*
+ * mem_sys_secs - time charged by the cost model since the program started
+ */
+double mem_sys_secs(void){
+    return sys_secs;
+}
+
+/* 
+ * mem_init - initialize the memory system model
+ */
+void mem_init(){
+    if (heap_file != NULL && (sparse || cost_syscalls)) {
+	fprintf(stderr, "FAILURE.  A heap file cannot be sparse or have its pages mprotected\n");
+	exit(1);
+    }
+    if (heap_file != NULL ? !file_map(&regions[0]) : !region_map(&regions[0], sparse ? MAX_SPARSE_HEAP_SIZE : MAX_HEAP_SIZE)) {
 	fprintf(stderr, "FAILURE.  mmap couldn't allocate space for heap\n");
 	exit(1);
     }
-    heap = addr;
-    mem_max_addr = addr + MAX_HEAP_SIZE;
-    mem_reset_brk();
+    num_regions = 1;
+    mem_pick_copies();
 }
 
 /* 
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_deinit(void){
-    if (munmap(heap, MAX_HEAP_SIZE) != 0) {
-        fprintf(stderr, "FAILURE.  munmap couldn't deallocate heap space\n");
-        exit(1);
+    if (heap_fd >= 0)
+        file_resize(regions[0].brk - regions[0].lo);
+    while (num_regions > 0) {
+        region_unmap(&regions[--num_regions]);
+    }
+    if (heap_fd >= 0) {
+        close(heap_fd);
+        heap_fd = -1;
     }
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointer to make an empty heap,
+ *              and drop every region but the heap
  */
 void mem_reset_brk(){
-    mem_brk = heap;
+    struct mem_region *r = &regions[0];
+    double start;
+
+    while (num_regions > 1) {
+        region_unmap(&regions[--num_regions]);
+    }
+    if (sparse)
+        sparse_drop((uintptr_t) r->lo, (uintptr_t) r->max);
+    if (cost_syscalls && r->touched > r->lo) {          /* give the pages back, so they fault again */
+        start = mem_clock();
+        madvise(r->lo, r->touched - r->lo, MADV_DONTNEED);
+        mprotect(r->lo, r->touched - r->lo, PROT_NONE);
+        sys_secs += mem_clock() - start;
+    }
+    r->brk = r->touched = r->lo;
+}
+
+/*
+ * mem_rewind_brk - move the simulated brk back to size bytes above the
+ *              start of the heap; the pages stay mapped, so bytes below
+ *              the new brk keep their contents
+ */
+void mem_rewind_brk(size_t size){
+    mem_region_rewind(0, size);
+}
+
+/*
+ * mem_region_create - reserve a new empty region of up to max bytes, return its id or -1
+ */
+int mem_region_create(size_t max){
+    size_t page = mem_pagesize();
+
+    if (num_regions == 0 || num_regions == MEM_REGIONS ||
+        !region_map(&regions[num_regions], (max + page - 1) & ~(page - 1))) {
+        errno = ENOMEM;
+        return -1;
+    }
+    return num_regions++;
 }
 
 /* 
- * mem_sbrk - simple model of the sbrk function. Extends the heap 
+ * mem_region_sbrk - simple model of the sbrk function. Extends region id
  *		by incr bytes and returns the start address of the new area. In
- *		this model, the heap cannot be shrunk.
+ *		this model, a region cannot be shrunk.
  */
-void *mem_sbrk(intptr_t incr) {
-    unsigned char *old_brk = mem_brk;
+void *mem_region_sbrk(int id, intptr_t incr) {
+    struct mem_region *r;
+    unsigned char *old_brk;
+
+    if (id < 0 || id >= num_regions) {
+	fprintf(stderr, "ERROR: mem_sbrk failed.  There is no region %d\n", id);
+	errno = EINVAL;
+	return (void *) -1;
+    }
+    r = &regions[id];
+    old_brk = r->brk;
 
     bool ok = true;
     if (incr < 0) {
 	ok = false;
 	fprintf(stderr, "ERROR: mem_sbrk failed.  Attempt to expand heap by negative value %ld\n", (long) incr);
-    } else if (mem_brk + incr > mem_max_addr) {
+    } else if (r->brk + incr > r->max) {
 	ok = false;
-	long alloc = mem_brk - heap + incr;
-	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory.  Would require heap size of %zd (0x%zx) bytes\n", alloc, alloc);
+	long alloc = r->brk - r->lo + incr;
+	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory.  Would require region %d size of %zd (0x%zx) bytes\n", id, alloc, alloc);
     }
     if (ok) {
-	mem_brk += incr;
+	if (cost_sbrk_ns != 0 || cost_page_ns != 0 || cost_syscalls)
+	    mem_charge(r, r->brk + incr);
+	if (id == 0 && heap_fd >= 0 && (size_t) (r->brk + incr - r->lo) > heap_file_size)
+	    file_resize((r->brk + incr - r->lo + MEM_FILE_STEP - 1) & ~(size_t) (MEM_FILE_STEP - 1));
+	r->brk += incr;
 	return (void *) old_brk;
     } else {
 	errno = ENOMEM;
@@ -85,25 +406,157 @@ void *mem_sbrk(intptr_t incr) {
     }
 }
 
+/*
+ * mem_region_rewind - mem_rewind_brk on region id
+ */
+void mem_region_rewind(int id, size_t size){
+    assert(id >= 0 && id < num_regions);
+    assert(regions[id].lo + size <= regions[id].brk);
+    regions[id].brk = regions[id].lo + size;
+}
+
+/*
+ * mem_region_lo - return address of the first byte of region id, NULL if there is no region id
+ */
+void *mem_region_lo(int id){
+    if (id < 0 || id >= num_regions) {
+        return NULL;
+    }
+    return (void *) regions[id].lo;
+}
+
+/* 
+ * mem_region_hi - return address of last byte of region id, NULL if there is no region id
+ */
+void *mem_region_hi(int id){
+    if (id < 0 || id >= num_regions) {
+        return NULL;
+    }
+    return (void *)(regions[id].brk - 1);
+}
+
+/*
+ * mem_region_size - returns the size of region id in bytes, 0 if there is no region id
+ */
+size_t mem_region_size(int id){
+    if (id < 0 || id >= num_regions) {
+        return 0;
+    }
+    return (size_t)(regions[id].brk - regions[id].lo);
+}
+
+/*
+ * mem_region_of - returns the id of the region whose bytes include addr, or -1
+ */
+int mem_region_of(const void *addr){
+    const unsigned char *a = addr;
+    int id;
+
+    for (id = 0; id < num_regions; id++) {
+        if (a >= regions[id].lo && a < regions[id].brk) {
+            return id;
+        }
+    }
+    return -1;
+}
+
+/*
+ * mem_total_size - returns the bytes in all regions together, the heap included
+ */
+size_t mem_total_size(){
+    size_t total = 0;
+    int id;
+
+    for (id = 0; id < num_regions; id++) {
+        total += mem_region_size(id);
+    }
+    return total;
+}
+
+/*
+ * mem_resident - returns the bytes of all regions that are in memory: pages
+ *              touched and not released since, as mincore sees them, or
+ *              the pages in the hash of a sparse heap
+ */
+size_t mem_resident(){
+    unsigned char vec[4096];
+    size_t page = mem_pagesize();
+    size_t total = 0;
+    size_t n, i;
+    unsigned char *p, *end;
+    int id;
+
+    if (sparse)
+        return sparse_pages * SPARSE_PAGE;
+    for (id = 0; id < num_regions; id++) {
+        end = regions[id].lo + ((mem_region_size(id) + page - 1) & ~(page - 1));
+        for (p = regions[id].lo; p < end; p += n * page) {
+            n = (size_t) (end - p) / page < sizeof(vec) ? (size_t) (end - p) / page : sizeof(vec);
+            if (mincore(p, n * page, vec) != 0) {
+                break;
+            }
+            for (i = 0; i < n; i++) {
+                total += (vec[i] & 1) * page;
+            }
+        }
+    }
+    return total;
+}
+
+/*
+ * mem_release - give the whole pages in [addr, addr + len) back to the OS, they read
+ *              as zero when touched again; charged like a mem_sbrk by the cost model
+ */
+void mem_release(void *addr, size_t len){
+    uintptr_t page = mem_pagesize();
+    unsigned char *from = (unsigned char *) (((uintptr_t) addr + page - 1) & ~(page - 1));
+    unsigned char *to = (unsigned char *) (((uintptr_t) addr + len) & ~(page - 1));
+    double start = mem_clock();
+    double cost = cost_sbrk_ns * 1e-9;
+
+    if (to > from && sparse) {
+        sparse_drop((uintptr_t) from, (uintptr_t) to);
+    } else if (to > from && heap_fd >= 0 && mem_region_of(from) == 0) {
+        if (madvise(from, to - from, MADV_REMOVE) != 0)     /* punches a hole in the file, or they must be zeroed */
+            memset(from, 0, to - from);
+    } else if (to > from) {
+        madvise(from, to - from, MADV_DONTNEED);
+    }
+    if (cost_syscalls) {
+        sys_secs += mem_clock() - start;
+    } else if (cost_sbrk_ns != 0) {
+        while (mem_clock() - start < cost)
+            ;
+        sys_secs += cost;
+    }
+}
+
+/* 
+ * mem_sbrk - mem_region_sbrk on the heap
+ */
+void *mem_sbrk(intptr_t incr) {
+    return mem_region_sbrk(0, incr);
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
 void *mem_heap_lo(){
-    return (void *) heap;
+    return (void *) regions[0].lo;
 }
 
 /* 
  * mem_heap_hi - return address of last heap byte
  */
 void *mem_heap_hi(){
-    return (void *)(mem_brk - 1);
+    return (void *)(regions[0].brk - 1);
 }
 
 /*
  * mem_heapsize() - returns the heap size in bytes
  */
 size_t mem_heapsize() {
-    return (size_t)(mem_brk - heap);
+    return (size_t)(regions[0].brk - regions[0].lo);
 }
 
 /*
@@ -115,20 +568,164 @@ size_t mem_pagesize(){
 
 /*************** Memory emulation  *******************/
 
-/* Read len bytes and return value zero-extended to 64 bits */
-uint64_t mem_read(const void *addr, size_t len) {
-    uint64_t rdata;
-    /* Dense or non-heap read */
-    rdata = *(uint64_t *) addr;
-    if (len < sizeof(uint64_t)) {
-	uint64_t mask = ((uint64_t) 1 << (8 * len)) - 1;
-	rdata &= mask;
+/*
+ * sparse_bucket - the chain a page of the hash belongs to
+ */
+static struct sparse_page **sparse_bucket(uintptr_t page) {
+    return &sparse_table[(size_t) ((page / SPARSE_PAGE) * 0x9E3779B97F4A7C15ull >> 20) & (sparse_buckets - 1)];
+}
+
+/*
+ * sparse_find - the page holding addr; if it has none yet, a new zeroed one
+ *              when create is set, NULL otherwise
+ */
+static struct sparse_page *sparse_find(uintptr_t addr, bool create) {
+    uintptr_t page = addr & ~(uintptr_t) (SPARSE_PAGE - 1);
+    struct sparse_page *p, *next, **old;
+    size_t i, old_buckets;
+
+    if (sparse_last != NULL && sparse_last->addr == page)
+        return sparse_last;
+    p = sparse_tlb[(page / SPARSE_PAGE) & (SPARSE_TLB - 1)];
+    if (p != NULL && p->addr == page)
+        return sparse_last = p;
+    for (p = sparse_buckets ? *sparse_bucket(page) : NULL; p != NULL; p = p->next) {
+        if (p->addr == page)
+            return sparse_last = sparse_tlb[(page / SPARSE_PAGE) & (SPARSE_TLB - 1)] = p;
+    }
+    if (!create)
+        return NULL;
+    if (sparse_pages >= sparse_buckets) {           /* at most one page per bucket on average */
+        old = sparse_table;
+        old_buckets = sparse_buckets;
+        sparse_buckets = old_buckets ? 2 * old_buckets : 1024;
+        sparse_table = calloc(sparse_buckets, sizeof(*sparse_table));
+        if (sparse_table == NULL) {
+            fprintf(stderr, "FAILURE.  Couldn't grow the sparse page table\n");
+            exit(1);
+        }
+        for (i = 0; i < old_buckets; i++) {
+            for (p = old[i]; p != NULL; p = next) {
+                next = p->next;
+                p->next = *sparse_bucket(p->addr);
+                *sparse_bucket(p->addr) = p;
+            }
+        }
+        free(old);
+    }
+    if ((p = calloc(1, sizeof(*p))) == NULL) {
+        fprintf(stderr, "FAILURE.  Couldn't allocate a sparse heap page\n");
+        exit(1);
+    }
+    p->addr = page;
+    p->next = *sparse_bucket(page);
+    *sparse_bucket(page) = p;
+    sparse_pages++;
+    return sparse_last = sparse_tlb[(page / SPARSE_PAGE) & (SPARSE_TLB - 1)] = p;
+}
+
+/*
+ * sparse_drop - free the pages of the hash that hold addresses in [lo, hi), one
+ *              lookup per page of the range or one pass over the table, whichever is less
+ */
+static void sparse_drop(uintptr_t lo, uintptr_t hi) {
+    struct sparse_page **link, *p;
+    uintptr_t page;
+    size_t i;
+
+    sparse_last = NULL;
+    memset(sparse_tlb, 0, sizeof(sparse_tlb));
+    if (sparse_pages == 0)
+        return;
+    if ((hi - lo) / SPARSE_PAGE < sparse_pages) {
+        for (page = lo & ~(uintptr_t) (SPARSE_PAGE - 1); page < hi; page += SPARSE_PAGE) {
+            for (link = sparse_bucket(page); *link != NULL && (*link)->addr != page; link = &(*link)->next)
+                ;
+            if ((p = *link) != NULL) {
+                *link = p->next;
+                free(p);
+                sparse_pages--;
+            }
+        }
+        return;
+    }
+    for (i = 0; i < sparse_buckets; i++) {
+        for (link = &sparse_table[i]; (p = *link) != NULL; ) {
+            if (p->addr >= lo && p->addr < hi) {
+                *link = p->next;
+                free(p);
+                sparse_pages--;
+            } else {
+                link = &p->next;
+            }
+        }
+    }
+}
+
+/*
+ * sparse_owns - true if addr is in one of the regions, so its bytes are in the hash
+ */
+static bool sparse_owns(const void *addr) {
+    const unsigned char *a = addr;
+    int id;
+
+    if (sparse_last != NULL && ((uintptr_t) a & ~(uintptr_t) (SPARSE_PAGE - 1)) == sparse_last->addr)
+        return true;
+    for (id = 0; id < num_regions; id++) {
+        if (a >= regions[id].lo && a < regions[id].max)
+            return true;
     }
+    return false;
+}
+
+/*
+ * sparse_move - copy len bytes between buf and the sparse bytes at addr, a page at a time;
+ *              a read of a page never written gives zeros and does not create it
+ */
+static void sparse_move(uintptr_t addr, unsigned char *buf, size_t len, bool write) {
+    struct sparse_page *p;
+    size_t off, n;
+
+    while (len > 0) {
+        off = addr & (SPARSE_PAGE - 1);
+        n = SPARSE_PAGE - off < len ? SPARSE_PAGE - off : len;
+        p = sparse_find(addr, write);
+        if (write)
+            memcpy(p->data + off, buf, n);
+        else if (p != NULL)
+            memcpy(buf, p->data + off, n);
+        else
+            memset(buf, 0, n);
+        addr += n;
+        buf += n;
+        len -= n;
+    }
+}
+
+/*
+ * load, store - mem_read and mem_write without the traffic counters, for the
+ *              copies and fills that count their bytes once as a whole
+ */
+static uint64_t load(const void *addr, size_t len) {
+    uint64_t rdata = 0;
+    if (sparse && sparse_owns(addr)) {
+        sparse_move((uintptr_t) addr, (unsigned char *) &rdata, len, false);
+        return rdata;
+    }
+    /* Dense or non-heap read; a short one must not read past the break,
+       which is the end of the mapping with mem_set_costs(.., true) */
+    if (len == sizeof(uint64_t))
+        rdata = *(uint64_t *) addr;
+    else
+        memcpy(&rdata, addr, len);
     return rdata;
 }
 
-/* Write lower order len bytes of val to address */
-void mem_write(void *addr, uint64_t val, size_t len) {
+static void store(void *addr, uint64_t val, size_t len) {
+    if (sparse && sparse_owns(addr)) {
+        sparse_move((uintptr_t) addr, (unsigned char *) &val, len, true);
+        return;
+    }
     /* Dense or non-heap write */
     if (len == sizeof(uint64_t))
         *(uint64_t *) addr = val;
@@ -136,58 +733,247 @@ void mem_write(void *addr, uint64_t val, size_t len) {
         memcpy(addr, (void *) &val, len);
 }
 
-/* Emulation of memcpy */
-void *mem_memcpy(void *dst, const void *src, size_t n) {
-    void *savedst = dst;
+/* Read len bytes and return value zero-extended to 64 bits */
+uint64_t mem_read(const void *addr, size_t len) {
+#ifdef MEM_TRAFFIC
+    traffic[traffic_kind].read += len;
+#endif
+    return load(addr, len);
+}
+
+/* Write lower order len bytes of val to address */
+void mem_write(void *addr, uint64_t val, size_t len) {
+#ifdef MEM_TRAFFIC
+    traffic[traffic_kind].written += len;
+#endif
+    store(addr, val, len);
+}
+
+/*
+ * copy_words, fill_words - memcpy and memset one load/store at a time,
+ *              the reference the vector versions below are picked over, and
+ *              what they do the unaligned ends with
+ */
+static void copy_words(unsigned char *dst, const unsigned char *src, size_t n) {
     size_t w = sizeof(uint64_t);
     while (n >= w) {
-	uint64_t data = mem_read(src, w);
-	mem_write(dst, data, w);
+	uint64_t data = load(src, w);
+	store(dst, data, w);
 	n -= w;
-	src = (void *) ((unsigned char *) src + w);
-	dst = (void *) ((unsigned char *) dst + w);
+	src += w;
+	dst += w;
     }
     if (n) {
-	uint64_t data = mem_read(src, n);
-	mem_write(dst, data, n);
+	uint64_t data = load(src, n);
+	store(dst, data, n);
     }
-    return savedst;
 }
 
-/* Emulation of memset */
-void *mem_memset(void *dst, int c, size_t n) {
-    void *savedst = dst;
-    uint64_t byte = c & 0xFF;
-    uint64_t data = 0;
+static void fill_words(unsigned char *dst, int c, size_t n) {
+    uint64_t data = (c & 0xFF) * 0x0101010101010101ull;
     size_t w = sizeof(uint64_t);
-    size_t i;
-    for (i = 0; i < w; i++) {
-	data = data | (byte << (8*i));
-    }
     while (n >= w) {
-	mem_write(dst, data, w);
+	store(dst, data, w);
 	n -= w;
-	dst = (void *) ((unsigned char *) dst + w);
+	dst += w;
     }
     if (n) {
-	mem_write(dst, data, n);	
+	store(dst, data, n);
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/*
+ * copy_sse2, fill_sse2 - 16 bytes at a time, 64 per iteration; from MEM_NT_BYTES
+ *              on the destination is aligned first and written with streaming stores
+ */
+static void copy_sse2(unsigned char *dst, const unsigned char *src, size_t n) {
+    size_t head;
+    if (n >= MEM_NT_BYTES) {
+        head = -(uintptr_t) dst & 15;
+        copy_words(dst, src, head);
+        dst += head; src += head; n -= head;
+        for (; n >= 64; n -= 64, dst += 64, src += 64) {
+            __m128i a = _mm_loadu_si128((const __m128i *) src);
+            __m128i b = _mm_loadu_si128((const __m128i *) (src + 16));
+            __m128i c = _mm_loadu_si128((const __m128i *) (src + 32));
+            __m128i d = _mm_loadu_si128((const __m128i *) (src + 48));
+            _mm_stream_si128((__m128i *) dst, a);
+            _mm_stream_si128((__m128i *) (dst + 16), b);
+            _mm_stream_si128((__m128i *) (dst + 32), c);
+            _mm_stream_si128((__m128i *) (dst + 48), d);
+        }
+        _mm_sfence();
+    }
+    for (; n >= 64; n -= 64, dst += 64, src += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i *) src);
+        __m128i b = _mm_loadu_si128((const __m128i *) (src + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *) (src + 32));
+        __m128i d = _mm_loadu_si128((const __m128i *) (src + 48));
+        _mm_storeu_si128((__m128i *) dst, a);
+        _mm_storeu_si128((__m128i *) (dst + 16), b);
+        _mm_storeu_si128((__m128i *) (dst + 32), c);
+        _mm_storeu_si128((__m128i *) (dst + 48), d);
+    }
+    for (; n >= 16; n -= 16, dst += 16, src += 16) {
+        _mm_storeu_si128((__m128i *) dst, _mm_loadu_si128((const __m128i *) src));
+    }
+    copy_words(dst, src, n);
+}
+
+static void fill_sse2(unsigned char *dst, int c, size_t n) {
+    __m128i v = _mm_set1_epi8((char) c);
+    size_t head;
+    if (n >= MEM_NT_BYTES) {
+        head = -(uintptr_t) dst & 15;
+        fill_words(dst, c, head);
+        dst += head; n -= head;
+        for (; n >= 64; n -= 64, dst += 64) {
+            _mm_stream_si128((__m128i *) dst, v);
+            _mm_stream_si128((__m128i *) (dst + 16), v);
+            _mm_stream_si128((__m128i *) (dst + 32), v);
+            _mm_stream_si128((__m128i *) (dst + 48), v);
+        }
+        _mm_sfence();
+    }
+    for (; n >= 16; n -= 16, dst += 16) {
+        _mm_storeu_si128((__m128i *) dst, v);
+    }
+    fill_words(dst, c, n);
+}
+
+/*
+ * copy_avx2, fill_avx2 - the same 32 bytes at a time, 128 per iteration
+ */
+__attribute__((target("avx2")))
+static void copy_avx2(unsigned char *dst, const unsigned char *src, size_t n) {
+    size_t head;
+    if (n >= MEM_NT_BYTES) {
+        head = -(uintptr_t) dst & 31;
+        copy_words(dst, src, head);
+        dst += head; src += head; n -= head;
+        for (; n >= 128; n -= 128, dst += 128, src += 128) {
+            __m256i a = _mm256_loadu_si256((const __m256i *) src);
+            __m256i b = _mm256_loadu_si256((const __m256i *) (src + 32));
+            __m256i c = _mm256_loadu_si256((const __m256i *) (src + 64));
+            __m256i d = _mm256_loadu_si256((const __m256i *) (src + 96));
+            _mm256_stream_si256((__m256i *) dst, a);
+            _mm256_stream_si256((__m256i *) (dst + 32), b);
+            _mm256_stream_si256((__m256i *) (dst + 64), c);
+            _mm256_stream_si256((__m256i *) (dst + 96), d);
+        }
+        _mm_sfence();
+    }
+    for (; n >= 128; n -= 128, dst += 128, src += 128) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) src);
+        __m256i b = _mm256_loadu_si256((const __m256i *) (src + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i *) (src + 64));
+        __m256i d = _mm256_loadu_si256((const __m256i *) (src + 96));
+        _mm256_storeu_si256((__m256i *) dst, a);
+        _mm256_storeu_si256((__m256i *) (dst + 32), b);
+        _mm256_storeu_si256((__m256i *) (dst + 64), c);
+        _mm256_storeu_si256((__m256i *) (dst + 96), d);
     }
-    return savedst;
+    for (; n >= 32; n -= 32, dst += 32, src += 32) {
+        _mm256_storeu_si256((__m256i *) dst, _mm256_loadu_si256((const __m256i *) src));
+    }
+    copy_words(dst, src, n);
+}
+
+__attribute__((target("avx2")))
+static void fill_avx2(unsigned char *dst, int c, size_t n) {
+    __m256i v = _mm256_set1_epi8((char) c);
+    size_t head;
+    if (n >= MEM_NT_BYTES) {
+        head = -(uintptr_t) dst & 31;
+        fill_words(dst, c, head);
+        dst += head; n -= head;
+        for (; n >= 128; n -= 128, dst += 128) {
+            _mm256_stream_si256((__m256i *) dst, v);
+            _mm256_stream_si256((__m256i *) (dst + 32), v);
+            _mm256_stream_si256((__m256i *) (dst + 64), v);
+            _mm256_stream_si256((__m256i *) (dst + 96), v);
+        }
+        _mm_sfence();
+    }
+    for (; n >= 32; n -= 32, dst += 32) {
+        _mm256_storeu_si256((__m256i *) dst, v);
+    }
+    fill_words(dst, c, n);
+}
+
+#endif
+
+static void (*copy_impl)(unsigned char *dst, const unsigned char *src, size_t n) = copy_words;
+static void (*fill_impl)(unsigned char *dst, int c, size_t n) = fill_words;
+
+/*
+ * mem_pick_copies - use the widest copy and fill the cpu supports, or the word loops on a sparse heap
+ */
+static void mem_pick_copies(void) {
+    copy_impl = copy_words;
+    fill_impl = fill_words;
+    if (sparse)                             /* every byte through load and store */
+        return;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    copy_impl = __builtin_cpu_supports("avx2") ? copy_avx2 : copy_sse2;
+    fill_impl = __builtin_cpu_supports("avx2") ? fill_avx2 : fill_sse2;
+#endif
+}
+
+/* Emulation of memcpy */
+void *mem_memcpy(void *dst, const void *src, size_t n) {
+#ifdef MEM_TRAFFIC
+    traffic[traffic_kind].copied += n;
+#endif
+    copy_impl(dst, src, n);
+    return dst;
+}
+
+/* Emulation of memset */
+void *mem_memset(void *dst, int c, size_t n) {
+#ifdef MEM_TRAFFIC
+    traffic[traffic_kind].set += n;
+#endif
+    fill_impl(dst, c, n);
+    return dst;
 }
 
+#ifdef MEM_TRAFFIC
+/*
+ * mem_traffic_kind - charge the traffic from now on to kind, return the kind it went to before
+ */
+int mem_traffic_kind(int kind) {
+    int old = traffic_kind;
+    traffic_kind = kind;
+    return old;
+}
+
+/*
+ * mem_traffic - the bytes charged to kind since the last mem_traffic_reset
+ */
+struct mem_traffic mem_traffic(int kind) {
+    return traffic[kind];
+}
+
+/*
+ * mem_traffic_reset - zero the counters of every kind
+ */
+void mem_traffic_reset(void) {
+    memset(traffic, 0, sizeof(traffic));
+}
+#endif
+
 /* Function to aid in viewing contents of heap */
 void hprobe(void *ptr, int offset, size_t count) {
     unsigned char *cptr = (unsigned char *) ptr;
     unsigned char *cptr_lo = cptr+offset;
     unsigned char *cptr_hi = cptr_lo + count - 1;
     unsigned char *iptr;
-    if ((void *) cptr_lo < mem_heap_lo()) {
-	fprintf(stderr, "Invalid probe.  Address %p is below start of heap\n",
-		cptr_lo);
-	return;
-    }
-    if ((void *) cptr_hi > mem_heap_hi()) {
-	fprintf(stderr, "Invalid probe.  Address %p is beyond end of heap\n",
+    if (mem_region_of(cptr_lo) < 0 || mem_region_of(cptr_hi) != mem_region_of(cptr_lo)) {
+	fprintf(stderr, "Invalid probe.  Address %p is outside the heap regions\n",
 		cptr_lo);
 	return;
     }
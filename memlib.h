@@ -6,11 +6,75 @@ void mem_init();
 void mem_deinit(void);
 void *mem_sbrk(intptr_t incr);
 void mem_reset_brk(void); 
+void mem_rewind_brk(size_t size);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
 
+/* Heap regions: separate address ranges, each with its own break.
+   Region 0 is the heap above; mem_reset_brk drops all the others */
+#define MEM_REGIONS 16
+int mem_region_create(size_t max);
+void *mem_region_sbrk(int id, intptr_t incr);
+void mem_region_rewind(int id, size_t size);
+void *mem_region_lo(int id);
+void *mem_region_hi(int id);
+size_t mem_region_size(int id);
+int mem_region_of(const void *addr);
+size_t mem_total_size(void);
+
+/* Residency: bytes of the regions in memory, and giving whole pages back */
+size_t mem_resident(void);
+void mem_release(void *addr, size_t len);
+
+/* Cost model: charge every mem_sbrk sbrk_ns and every page the break passes
+   for the first time page_ns, by spinning; or with syscalls, keep the heap
+   PROT_NONE above the break and really mprotect it as the break moves, so new
+   pages fault on first touch. mem_sys_secs is the time charged so far */
+void mem_set_costs(long sbrk_ns, long page_ns, bool syscalls);
+double mem_sys_secs(void);
+
+/* Transparent huge pages: regions mapped after mem_set_hugepages(true) start
+   on a MEM_HUGEPAGE boundary and are advised MADV_HUGEPAGE; mem_hugepage_size
+   tells the allocator whether the heap is, so it can grow in whole huge pages */
+#define MEM_HUGEPAGE (2ul << 20)
+void mem_set_hugepages(bool on);
+size_t mem_hugepage_size(void);
+
+/* Sparse heap: after mem_set_sparse(true), regions mapped by mem_init and
+   mem_region_create are only reserved address space, and the bytes written to
+   them live in a hash of 4 KiB pages that mem_read, mem_write, mem_memcpy and
+   mem_memset go through; any other access to them faults. Pages never written
+   read as zero and are not resident. The heap can then be MAX_SPARSE_HEAP_SIZE */
+void mem_set_sparse(bool on);
+bool mem_sparse(void);
+
+/* File-backed heap: after mem_set_file(path), mem_init maps the heap from that
+   file (created if need be), which grows with the break and is cut back to it
+   when mem_remap or mem_deinit let go of it; a file an earlier run left is
+   mapped back with the break at its end. mem_remap maps the file again at
+   another address and drops the old mapping, as a restart would. Not with a
+   sparse heap or mprotected pages */
+void mem_set_file(const char *path);
+bool mem_remap(void);
+
+/* Traffic counters, compiled in only with -DMEM_TRAFFIC (make traffic): the
+   bytes moved through mem_read, mem_write, mem_memcpy and mem_memset, charged
+   to the kind last set with mem_traffic_kind, which returns the one before */
+enum { MEM_KIND_OTHER, MEM_KIND_REALLOC, MEM_KIND_CALLOC, MEM_KIND_DRIVER, MEM_KINDS };
+struct mem_traffic {
+    size_t read;       /* mem_read */
+    size_t written;    /* mem_write */
+    size_t copied;     /* mem_memcpy */
+    size_t set;        /* mem_memset */
+};
+#ifdef MEM_TRAFFIC
+int mem_traffic_kind(int kind);
+struct mem_traffic mem_traffic(int kind);
+void mem_traffic_reset(void);
+#endif
+
 /* Functions used for memory emulation */
 
 /* Read len bytes and return value zero-extended to 64 bits */
@@ -0,0 +1,380 @@
+/*
+ * memsys.c - the memlib.h interface on real memory from the OS, for
+ * the libmm.so build of mm.c that replaces malloc in other programs.
+ *
+ * The heap, like every region from mem_region_create, is one range
+ * of address space reserved with mmap and committed with mprotect as
+ * its break moves up, so untouched pages cost no RSS and the break
+ * can never run into another mapping.  MM_HUGEPAGES=1 in the
+ * environment puts the heap on transparent huge pages.  Nothing here
+ * may call malloc or stdio on the normal paths: this is what malloc
+ * runs on.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include "memlib.h"
+
+#ifndef MEMSYS_RESERVE
+#define MEMSYS_RESERVE (64ull << 30)   /* address space reserved for the heap */
+#endif
+#define MEMSYS_COMMIT MEM_HUGEPAGE     /* break moves are committed in steps of this many bytes, whole huge pages */
+
+/*
+ * A region is one reservation with its own break; region 0 is the heap.
+ */
+struct mem_region {
+    unsigned char *lo;                      /* Starting address of the region */
+    unsigned char *brk;                     /* Current position of its break */
+    unsigned char *commit;                  /* End of the committed (read/write) part */
+    unsigned char *max;                     /* Maximum allowable address */
+};
+
+/* private global variables */
+static struct mem_region regions[MEM_REGIONS];
+static int num_regions;                     /* regions in use, 0 until a reservation worked */
+static bool huge_pages;                     /* set by mem_set_hugepages, or MM_HUGEPAGES=1 in the environment */
+static bool heap_huge;                      /* the heap was mapped with huge_pages */
+
+/*
+ * region_map - reserve size bytes of address space for region r, nothing committed yet;
+ *              with huge_pages aligned to MEM_HUGEPAGE and advised MADV_HUGEPAGE
+ */
+static bool region_map(struct mem_region *r, size_t size){
+    size_t slack = huge_pages ? MEM_HUGEPAGE : 0;
+    unsigned char *addr = mmap(NULL, size + slack, PROT_NONE,
+                               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    unsigned char *lo;
+
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    if (huge_pages) {                       /* keep the aligned part, mprotect keeps the advice */
+        lo = (unsigned char *) (((uintptr_t) addr + slack - 1) & ~(uintptr_t) (slack - 1));
+        if (lo > addr) {
+            munmap(addr, lo - addr);
+        }
+        munmap(lo + size, addr + slack - lo);
+        madvise(lo, size, MADV_HUGEPAGE);
+        addr = lo;
+    }
+    r->lo = r->brk = r->commit = addr;
+    r->max = addr + size;
+    return true;
+}
+
+/*
+ * mem_init - reserve the address space of the heap, only the first call does anything
+ */
+void mem_init(){
+    const char *env = getenv("MM_HUGEPAGES");
+
+    if (env != NULL && env[0] == '1') {
+        huge_pages = true;
+    }
+    if (num_regions == 0 && region_map(&regions[0], MEMSYS_RESERVE)) {
+        num_regions = 1;                    /* otherwise mem_sbrk fails from now on */
+        heap_huge = huge_pages;
+    }
+}
+
+/*
+ * mem_deinit - give every region back to the OS
+ */
+void mem_deinit(void){
+    while (num_regions > 0) {
+        num_regions--;
+        munmap(regions[num_regions].lo, regions[num_regions].max - regions[num_regions].lo);
+    }
+}
+
+/*
+ * mem_drop - return the pages of region r above addr to the OS, they read as zero when touched again
+ */
+static void mem_drop(struct mem_region *r, unsigned char *addr){
+    size_t page = mem_pagesize();
+    unsigned char *from = (unsigned char *) (((uintptr_t) addr + page - 1) & ~(uintptr_t) (page - 1));
+
+    if (from < r->commit) {
+        madvise(from, r->commit - from, MADV_DONTNEED);
+    }
+}
+
+/*
+ * mem_reset_brk - make an empty heap, its pages go back to the OS, and drop the other regions
+ */
+void mem_reset_brk(){
+    while (num_regions > 1) {
+        num_regions--;
+        munmap(regions[num_regions].lo, regions[num_regions].max - regions[num_regions].lo);
+    }
+    if (num_regions == 1) {
+        regions[0].brk = regions[0].lo;
+        mem_drop(&regions[0], regions[0].lo);
+    }
+}
+
+/*
+ * mem_rewind_brk - move the break back to size bytes above the start of the heap,
+ *              bytes below the new break keep their contents, the pages above it are dropped
+ */
+void mem_rewind_brk(size_t size){
+    mem_region_rewind(0, size);
+}
+
+/*
+ * mem_region_create - reserve a new empty region of up to max bytes, return its id or -1
+ */
+int mem_region_create(size_t max){
+    size_t page = mem_pagesize();
+
+    if (num_regions == 0 || num_regions == MEM_REGIONS ||
+        !region_map(&regions[num_regions], (max + page - 1) & ~(page - 1))) {
+        errno = ENOMEM;
+        return -1;
+    }
+    return num_regions++;
+}
+
+/*
+ * mem_region_sbrk - extend region id by incr bytes and return the start address of the new area,
+ *		committing more of the reservation when the break passes its end. A region cannot be shrunk.
+ */
+void *mem_region_sbrk(int id, intptr_t incr) {
+    struct mem_region *r;
+    unsigned char *old_brk;
+    unsigned char *commit;
+
+    if (id < 0 || id >= num_regions) {
+        errno = EINVAL;
+        return (void *) -1;
+    }
+    r = &regions[id];
+    old_brk = r->brk;
+    if (incr < 0 || (size_t) incr > (size_t) (r->max - r->brk)) {
+        errno = ENOMEM;
+        return (void *) -1;
+    }
+    if (r->brk + incr > r->commit) {
+        commit = r->lo + ((r->brk + incr - r->lo + MEMSYS_COMMIT - 1) & ~(MEMSYS_COMMIT - 1));
+        if (commit > r->max) {
+            commit = r->max;
+        }
+        if (mprotect(r->commit, commit - r->commit, PROT_READ | PROT_WRITE) != 0) {
+            errno = ENOMEM;
+            return (void *) -1;
+        }
+        r->commit = commit;
+    }
+    r->brk += incr;
+    return (void *) old_brk;
+}
+
+/*
+ * mem_region_rewind - mem_rewind_brk on region id, nothing happens if there is no region id
+ */
+void mem_region_rewind(int id, size_t size){
+    if (id >= 0 && id < num_regions && regions[id].lo + size <= regions[id].brk) {
+        regions[id].brk = regions[id].lo + size;
+        mem_drop(&regions[id], regions[id].brk);
+    }
+}
+
+/*
+ * mem_region_lo - return address of the first byte of region id, NULL if there is no region id
+ */
+void *mem_region_lo(int id){
+    if (id < 0 || id >= num_regions) {
+        return NULL;
+    }
+    return (void *) regions[id].lo;
+}
+
+/*
+ * mem_region_hi - return address of last byte of region id, NULL if there is no region id
+ */
+void *mem_region_hi(int id){
+    if (id < 0 || id >= num_regions) {
+        return NULL;
+    }
+    return (void *)(regions[id].brk - 1);
+}
+
+/*
+ * mem_region_size - returns the size of region id in bytes, 0 if there is no region id
+ */
+size_t mem_region_size(int id){
+    if (id < 0 || id >= num_regions) {
+        return 0;
+    }
+    return (size_t)(regions[id].brk - regions[id].lo);
+}
+
+/*
+ * mem_region_of - returns the id of the region whose bytes include addr, or -1
+ */
+int mem_region_of(const void *addr){
+    const unsigned char *a = addr;
+    int id;
+
+    for (id = 0; id < num_regions; id++) {
+        if (a >= regions[id].lo && a < regions[id].brk) {
+            return id;
+        }
+    }
+    return -1;
+}
+
+/*
+ * mem_total_size - returns the bytes in all regions together, the heap included
+ */
+size_t mem_total_size(){
+    size_t total = 0;
+    int id;
+
+    for (id = 0; id < num_regions; id++) {
+        total += mem_region_size(id);
+    }
+    return total;
+}
+
+/*
+ * mem_resident - returns the bytes of all regions that are in memory: pages
+ *              touched and not released since, as mincore sees them
+ */
+size_t mem_resident(){
+    unsigned char vec[4096];
+    size_t page = mem_pagesize();
+    size_t total = 0;
+    size_t n, i;
+    unsigned char *p, *end;
+    int id;
+
+    for (id = 0; id < num_regions; id++) {
+        end = regions[id].lo + ((mem_region_size(id) + page - 1) & ~(page - 1));
+        for (p = regions[id].lo; p < end; p += n * page) {
+            n = (size_t) (end - p) / page < sizeof(vec) ? (size_t) (end - p) / page : sizeof(vec);
+            if (mincore(p, n * page, vec) != 0) {
+                break;
+            }
+            for (i = 0; i < n; i++) {
+                total += (vec[i] & 1) * page;
+            }
+        }
+    }
+    return total;
+}
+
+/*
+ * mem_release - give the whole pages in [addr, addr + len) back to the OS, they read as zero when touched again
+ */
+void mem_release(void *addr, size_t len){
+    uintptr_t page = mem_pagesize();
+    unsigned char *from = (unsigned char *) (((uintptr_t) addr + page - 1) & ~(page - 1));
+    unsigned char *to = (unsigned char *) (((uintptr_t) addr + len) & ~(page - 1));
+
+    if (to > from) {
+        madvise(from, to - from, MADV_DONTNEED);
+    }
+}
+
+/*
+ * mem_sbrk - mem_region_sbrk on the heap
+ */
+void *mem_sbrk(intptr_t incr) {
+    return mem_region_sbrk(0, incr);
+}
+
+/*
+ * mem_heap_lo - return address of the first heap byte
+ */
+void *mem_heap_lo(){
+    return (void *) regions[0].lo;
+}
+
+/*
+ * mem_heap_hi - return address of last heap byte
+ */
+void *mem_heap_hi(){
+    return (void *)(regions[0].brk - 1);
+}
+
+/*
+ * mem_heapsize() - returns the heap size in bytes
+ */
+size_t mem_heapsize() {
+    return (size_t)(regions[0].brk - regions[0].lo);
+}
+
+/*
+ * mem_pagesize() - returns the page size of the system
+ */
+size_t mem_pagesize(){
+    return (size_t) getpagesize();
+}
+
+/*
+ * mem_set_costs - no cost model here, the costs are real
+ */
+void mem_set_costs(long sbrk_ns, long page_ns, bool syscalls){
+}
+
+double mem_sys_secs(void){
+    return 0;
+}
+
+/*
+ * mem_set_hugepages - back regions mapped from now on with transparent huge pages or not
+ */
+void mem_set_hugepages(bool on){
+    huge_pages = on;
+}
+
+/*
+ * mem_hugepage_size - the huge page size the heap is aligned to, 0 if it is not
+ */
+size_t mem_hugepage_size(void){
+    return heap_huge ? MEM_HUGEPAGE : 0;
+}
+
+/*************** Memory access, no emulation  *******************/
+
+/* Read len bytes and return value zero-extended to 64 bits */
+uint64_t mem_read(const void *addr, size_t len) {
+    uint64_t rdata = 0;
+    memcpy(&rdata, addr, len);
+    return rdata;
+}
+
+/* Write lower order len bytes of val to address */
+void mem_write(void *addr, uint64_t val, size_t len) {
+    memcpy(addr, &val, len);
+}
+
+void *mem_memcpy(void *dst, const void *src, size_t n) {
+    return memcpy(dst, src, n);
+}
+
+void *mem_memset(void *dst, int c, size_t n) {
+    return memset(dst, c, n);
+}
+
+/* Function to aid in viewing contents of heap */
+void hprobe(void *ptr, int offset, size_t count) {
+    unsigned char *cptr_lo = (unsigned char *) ptr + offset;
+    unsigned char *cptr_hi = cptr_lo + count - 1;
+    unsigned char *iptr;
+    if (mem_region_of(cptr_lo) < 0 || mem_region_of(cptr_hi) != mem_region_of(cptr_lo)) {
+        fprintf(stderr, "Invalid probe.  Address %p is outside the heap regions\n", cptr_lo);
+        return;
+    }
+    fprintf(stderr, "Bytes %p...%p: 0x", cptr_hi, cptr_lo);
+    for (iptr = cptr_hi; iptr >= cptr_lo; iptr--)
+        fprintf(stderr, "%.2x", *iptr);
+    fprintf(stderr, "\n");
+}
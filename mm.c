@@ -20,6 +20,19 @@
 #include "mm.h" 
 #include "memlib.h"
 
+#if defined(MM_THREADS) || !defined(DRIVER)
+#include <pthread.h>
+#endif
+#ifndef DRIVER
+#include <errno.h>
+#endif
+#if defined(PACKEDBINS) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
+#ifdef CACHESIM
+#include "cachesim.h"
+#endif
+
 /*
  * If you want to enable your debugging output and heap checker code,
  * uncomment the following line. Be sure not to have debugging enabled
@@ -46,6 +59,8 @@
 #define calloc mm_calloc
 #define memset mem_memset
 #define memcpy mem_memcpy
+#define memalign mm_memalign
+#define malloc_cacheline mm_malloc_cacheline
 #endif /* DRIVER */
 
 /* What is the correct alignment? */
@@ -54,6 +69,205 @@
 #define DSIZE 16
 #define SEGLISTNUM 16
 #define CHUNKSIZE (1 << 12)
+#define SMALLBLK 128        // requests up to this size are carved from the back of a larger free blk
+#define CACHELINE 64        // malloc_cacheline gives every blk whole lines of its own
+#define GROW_STEPS 8        // after mm_hint_peak, the heap grows to the peak in steps of 1/GROW_STEPS of it
+#define RESET_SPANS 16      // mm_reset snapshot: at most this many runs of heap bytes
+#define RESET_BYTES 2048    // and this many bytes in total
+#define ARENA_FIRST (1 << 12)   // first chunk of an arena, each later one is twice the last
+#define ARENA_MAX (256 << 10)   // up to this size
+#define POOL_CHUNK (1 << 14)    // pool chunks are this big and aligned to their size, objects find their chunk by masking
+#define POOL_HDRWORDS 6         // header words at the start of every pool chunk
+#define GROWN_BIT 0x8           // header bit 3 of an allocated blk: realloc has grown it before
+
+/*
+ * Build with -DLINE_MIN=a -DLINE_MAX=b to serve every malloc of a..b bytes like malloc_cacheline,
+ * for structures that different threads write at the same time.
+ */
+#if defined(LINE_MIN) != defined(LINE_MAX)
+#error "LINE_MIN and LINE_MAX must be given together"
+#endif
+
+/*
+ * Build with -DCACHESIM to hand every GET, PUT and PUT_ADDRESS to the driver's cache simulator (cachesim.c),
+ * which counts the cache and TLB misses of the allocator's own bookkeeping.
+ */
+#if defined(CACHESIM) && !defined(DRIVER)
+#error "CACHESIM needs the driver's cache simulator"
+#endif
+
+/*
+ * Build with -DMEM_EMULATE to make GET, PUT and PUT_ADDRESS go through mem_read and mem_write,
+ * the only way to reach a sparse heap (mem_set_sparse, mdriver -E). The builds that touch heap words
+ * any other way cannot run on one.
+ */
+#if defined(MEM_EMULATE) && (defined(PAGERUN) || defined(PACKEDBINS) || defined(BUDDY) || defined(MM_THREADS) || !defined(DRIVER))
+#error "MEM_EMULATE cannot be combined with PAGERUN, PACKEDBINS, BUDDY or MM_THREADS, and needs DRIVER"
+#endif
+
+/*
+ * Build with -DPERSIST to store every address in the heap as an offset from its first byte (PUT_ADDRESS),
+ * so a heap backed by a file (mem_set_file, mdriver -F) can be mapped again anywhere and taken over by
+ * mm_attach. The builds that keep addresses any other way, or state outside the heap, cannot do that.
+ */
+#if defined(PERSIST) && (defined(PAGERUN) || defined(PACKEDBINS) || defined(BUDDY) || defined(OOBMETA) || defined(MM_THREADS) || !defined(DRIVER))
+#error "PERSIST cannot be combined with PAGERUN, PACKEDBINS, BUDDY, OOBMETA or MM_THREADS, and needs DRIVER"
+#endif
+
+/*
+ * Build with -DADDRORDER to keep every seg list sorted by address instead of LIFO.
+ * Each list is then a skip list: a free blk of size s has room for (s - DSIZE) / WSIZE forward links
+ * between its header and footer, so its tower height is drawn at random but capped by that room.
+ */
+#ifdef ADDRORDER
+#define SKIPLEVELS 8
+#define ROOTWORDS SKIPLEVELS    // every root holds one forward link per level
+#else
+#define ROOTWORDS 1
+#endif
+
+/*
+ * Build with -DPAGERUN to serve requests of RUN_MIN..RUN_MAX bytes in whole pages.
+ * Runs are carved from page-aligned spans, which are ordinary allocated blks. A new span is as big as the
+ * run it is made for, or half as big as all the spans held so far if that is more (up to SPAN_MAXPAGES),
+ * so the spans grow geometrically from the size of the first run and a lone medium request costs no more than its pages.
+ * A run has no header: its start and length live in a run record, and a radix tree maps
+ * the first and last page of every run to its record. The tree lives in a memlib region of its own
+ * (run_region) and gains a level of 1 KiB nodes whenever the heap outgrows it, so a heap below
+ * 512 KiB pays 1 KiB for it and nothing of it is in the heap.
+ */
+#ifdef PAGERUN
+#define PAGESHIFT 12
+#define PAGESIZE (1 << PAGESHIFT)
+#define RUN_MIN PAGESIZE
+#define RUN_MAX (256 << 10)
+#define RUN_MAXPAGES (RUN_MAX >> PAGESHIFT)
+#define SPAN_MAXPAGES 16            // spans grow with the pages already in spans up to this, a bigger run gets a span of its own size
+#define RADIX_BITS 7                // bits of page number per level, 4 levels cover the 1 TB heap
+#define RADIX_NODE ((1 << RADIX_BITS) * WSIZE)
+#define RUN_REGION (1ull << 32)     // address space reserved for the page map
+#endif
+
+/*
+ * Build with -DPAGERUN -DRUNCOLOR to color the runs: the payload of a run starts COLOR bytes times
+ * a color into its first page, and successive runs of the same number of pages take successive colors.
+ * Otherwise every run starts on a page boundary and their first lines all compete for the same cache sets.
+ * Only the slack between the request and the end of the run is used, so coloring never costs a page.
+ */
+#ifdef RUNCOLOR
+#ifndef PAGERUN
+#error "RUNCOLOR colors page runs and needs PAGERUN"
+#endif
+#define COLOR 64                        // one cache line
+#define RUN_COLORS (PAGESIZE / COLOR)   // enough colors to reach every set of a 4 KiB cache way
+#endif
+
+/*
+ * Build with -DPACKEDBINS to replace the linked seg lists by packed bins.
+ * A bin is a chain of chunks, each holding the blk sizes of 8 lanes in 16-byte granules and a parallel
+ * array of blk pointers, so a fit is found by comparing a whole chunk at once (one AVX2 or two SSE2
+ * compares) without touching the free blks. A free blk only stores its chunk and lane, removal moves
+ * the newest slot of the bin into it. Only the newest chunk of a bin is partly filled, emptied chunks
+ * go to a pool shared by all bins, and the chunks live in a memlib region of their own (bin_region),
+ * so they never split the free space of the heap and cost about 14 bytes per free blk at the peak.
+ */
+#ifdef PACKEDBINS
+#if defined(ADDRORDER) || defined(OOBMETA)
+#error "PACKEDBINS replaces the seg lists and cannot be combined with ADDRORDER or OOBMETA"
+#endif
+#define BIN_LANES 8                  // slots per chunk, one AVX2 compare
+#define BIN_CHUNK (2*WSIZE + BIN_LANES * (sizeof(uint32_t) + WSIZE))   // link, count, sizes and pointers, a multiple of 16
+#define BIN_REGION (1ull << 36)      // address space reserved for the chunks
+#define GRANULE_MAX 0x7FFFFFFF       // stored sizes saturate here so that a signed compare works
+#endif
+
+/*
+ * Build with -DMM_THREADS to make malloc, free, realloc and calloc thread safe.
+ * Everything runs under one mutex except the small classes: a freed blk of at most MT_SMALL bytes stays
+ * allocated and is pushed on a lock-free stack for its exact size, where malloc pops it again.
+ * A stack head keeps a generation tag in the bits above TAG_SHIFT, which heap addresses never use,
+ * so a pop that raced with a pop and a push of the same blk (ABA) fails its compare-and-swap.
+ */
+#ifdef MM_THREADS
+#if defined(PAGERUN) || defined(OOBMETA)
+#error "MM_THREADS needs a header in front of every blk and cannot be combined with PAGERUN or OOBMETA"
+#endif
+#define MT_SMALL 80                  // blks of 32, 48, 64 and 80 bytes bypass the lock
+#define MT_CLASSES (MT_SMALL / DSIZE - 1)
+#define TAG_SHIFT 48
+#endif
+
+/*
+ * Build with -DLIFETIME to keep short-lived and long-lived blks apart, see mm_malloc_hint.
+ * Long-lived blks stay in the heap, short-lived ones get a memlib region of their own (life_region)
+ * with its own prologue, epilogue and wilderness, and each class has its own SEGLISTNUM seg lists.
+ * A request is served from its class only, so a short-lived blk is never carved out of the free space
+ * between long-lived ones and the short-lived region shrinks back to one free run whenever it empties.
+ * Every blk carries its class (LIFE_BIT in its header), which tells free which lists it goes back to.
+ */
+#ifdef LIFETIME
+#if defined(ADDRORDER) || defined(PACKEDBINS) || defined(OOBMETA) || defined(MM_THREADS) || defined(PERSIST)
+#error "LIFETIME keeps a set of seg lists and a region per class and cannot be combined with ADDRORDER, PACKEDBINS, OOBMETA, MM_THREADS or PERSIST"
+#endif
+#define LIFE_CLASSES 2
+#define LIFE_BIT 0x4                 // header bit 2: the blk belongs to the short-lived class
+#define LIFE_REGION (1ull << 36)     // address space reserved for the short-lived region
+#define ROOTS (SEGLISTNUM * LIFE_CLASSES)
+#else
+#define LIFE_BIT 0
+#define ROOTS SEGLISTNUM
+#endif
+
+/*
+ * Build with -DBUDDY to serve requests of BUDDY_MIN..BUDDY_MAX bytes (defaults below, both can be given
+ * with -D) from binary buddy arenas. An arena is a 4 KiB allocated blk aligned to its size, cut into
+ * blocks of 16 << k bytes that have no header: the buddy of a block is found by flipping bit 4 + k of
+ * its offset, and two bitmaps with one bit per block of every order say which blocks are free and which
+ * are split. The bitmaps live at the start of the arena; those bytes and the last 16 of the arena,
+ * which hold the header of the next blk in the heap, stay allocated for good.
+ */
+#ifdef BUDDY
+#if defined(PAGERUN) || defined(OOBMETA) || defined(MM_THREADS)
+#error "BUDDY keeps headerless blocks of its own and cannot be combined with PAGERUN, OOBMETA or MM_THREADS"
+#endif
+#ifndef BUDDY_MIN
+#define BUDDY_MIN 1
+#endif
+#ifndef BUDDY_MAX
+#define BUDDY_MAX 1024
+#endif
+#define BUDDY_SHIFT 12
+#define BUDDY_ARENA (1 << BUDDY_SHIFT)
+#define BUDDY_TOP (BUDDY_SHIFT - 4)          // order of the whole arena, order 0 is a 16-byte block
+#define BUDDY_MAP ((2 << BUDDY_TOP) / 8)     // bytes per bitmap: block n has children 2n and 2n+1, the arena is 1
+#define BUDDY_META (2*BUDDY_MAP + DSIZE)     // both bitmaps and the count of bytes in use
+#if BUDDY_MAX > BUDDY_ARENA / 4
+#error "BUDDY_MAX must be at most a quarter of a buddy arena"
+#endif
+#endif
+
+/*
+ * Build with -DOOBMETA to keep no metadata next to user data at all.
+ * The heap is cut into SEG_SIZE windows. A normal segment starts with a 4-word header and two bitmaps
+ * with one bit per 16-byte granule of the segment: "a blk starts here" and "that blk is allocated".
+ * Blk sizes are the distance to the next start bit, free blks are found by scanning the bitmaps,
+ * and coalescing only clears start bits. Requests that do not fit a normal segment get a large segment
+ * (header + one blk) of their own.
+ */
+#ifdef OOBMETA
+#if defined(ADDRORDER) || defined(PAGERUN)
+#error "OOBMETA replaces the seg lists and cannot be combined with ADDRORDER or PAGERUN"
+#endif
+#ifdef LINE_MIN
+#error "OOBMETA has no aligned allocation, so LINE_MIN cannot be used"
+#endif
+#define SEG_SIZE (1 << 16)
+#define SEG_MAPWORDS 63                                      // words per bitmap, enough for SEG_GRANULES bits
+#define SEG_DATA (4*WSIZE + 2*SEG_MAPWORDS*WSIZE)             // offset of the first granule: header + both bitmaps
+#define SEG_GRANULES ((SEG_SIZE - SEG_DATA) / DSIZE)          // 4031 granules of user data per normal segment
+#define SEG_LARGE 0x1                                        // header word 0: segment holds one large blk
+#define SEG_FREE 0x2                                         // header word 0: that large blk is free
+#endif
 
 
 /******************** Helper function ********************/
@@ -70,22 +284,52 @@ static size_t PACK(size_t size, size_t alloc)    // from text book, used to pack
 
 static size_t GET(void *p)      // from text book, read a word at p
 {
+#ifdef CACHESIM
+    cachesim_access(p);
+#endif
+#ifdef MEM_EMULATE
+    return mem_read(p, WSIZE);
+#else
     return (*(size_t *)(p));
+#endif
 }
 
 static void PUT(void *p, size_t val)      // from text book, write a word at p
 {
+#ifdef CACHESIM
+    cachesim_access(p);
+#endif
+#ifdef MEM_EMULATE
+    mem_write(p, val, WSIZE);
+#else
     (*(size_t *)(p)) = val;
+#endif
 }
 
+static char *ROOT(size_t id);        // address of the root of seg list id, defined below the globals
+
 static void PUT_ADDRESS(void *p, void *val)      // same as PUT but a pointer should be passed in because we are using it to store an address
 {
-    (*(size_t *)(p)) = (size_t )val;
+#ifdef PERSIST
+    PUT(p, val == NULL ? 0 : (size_t) ((char *) val - ROOT(0)));   // stored as an offset from the first heap byte, which is never a link target
+#else
+    PUT(p, (size_t) val);
+#endif
+}
+
+static char *GET_ADDRESS(void *p)     // read an address stored by PUT_ADDRESS
+{
+#ifdef PERSIST
+    size_t offset = GET(p);
+    return offset == 0 ? NULL : ROOT(0) + offset;
+#else
+    return (char *) GET(p);
+#endif
 }
 
 static size_t GET_SIZE(void *p)      // from text book, pass in a pointer pointing to the header or footer then return the size of this blk
 {
-    return GET(p) & ~0X7;
+    return GET(p) & ~0xF;
 }
 
 static size_t GET_ALLOC(void *p)      // from text book, pass in a pointer pointing to the header or footer then return if this blk is free or not
@@ -93,6 +337,11 @@ static size_t GET_ALLOC(void *p)      // from text book, pass in a pointer point
     return GET(p) & 0x1;
 }
 
+static size_t LIFE(void *p)           // pass in a pointer pointing to the header, return its LIFE_BIT (always 0 without LIFETIME)
+{
+    return GET(p) & LIFE_BIT;
+}
+
 static size_t PREV_ALLOC(void *p)     // pass in a pointer pointing to the header or footer then return if previous blk in heap is free or not
 {                                     // I am using the last bit for alloc info of this blk and using the second last bit for alloc info of previous blk
     return GET(p) & 0x2;
@@ -133,8 +382,57 @@ static char *PREV_BLK(void *bp)
 /*********************************************************/
 
 /* Global pointers */
-static char *heap_listp = NULL;
 static char *list_header_ptr = NULL;
+#ifndef OOBMETA
+static char *heap_listp = NULL;
+static char *wilderness = NULL;     // set by search() when it skips the free blk right before the epilogue
+static size_t life_class = 0;       // LIFE_BIT while a short-lived request is served, never set without LIFETIME
+#ifdef LIFETIME
+static int life_region = 0;         // memlib region of the short-lived class
+static char *life_listp = NULL;     // first blk of that region
+#endif
+static size_t grow_peak = 0;        // heap size expected by mm_hint_peak, 0 if there was no hint
+static size_t grow_step = 0;        // smallest extension of the heap while it is below grow_peak
+static char *reset_lo = NULL;       // heap the snapshot was taken of
+static size_t reset_brk = 0;        // heap size right after mm_init, 0 if there is no snapshot
+static size_t reset_span[RESET_SPANS][2];   // offset from the heap start and length of each saved run
+static size_t reset_nspans = 0;
+static size_t reset_used = 0;       // bytes of reset_image in use
+static char reset_image[RESET_BYTES];
+#ifdef ADDRORDER
+static unsigned int reset_seed;     // skip_seed right after mm_init
+#endif
+#endif
+#ifdef ADDRORDER
+static unsigned int skip_seed = 1;  // state of the random number generator for tower heights
+#endif
+#ifdef PACKEDBINS
+static int bin_region = 0;          // memlib region of the bin arrays
+static char *bin_pool = NULL;       // emptied chunks, linked through their first word
+#endif
+
+static char *ROOT(size_t id)
+{
+    return list_header_ptr + id*ROOTWORDS*WSIZE;
+}
+
+#ifndef OOBMETA
+
+static int heap_region(void)         // memlib region of the class being served, the heap unless LIFETIME serves a short-lived request
+{
+#ifdef LIFETIME
+    return life_class ? life_region : 0;
+#else
+    return 0;
+#endif
+}
+
+static char *heap_end(void)          // first byte after the epilogue of the class being served
+{
+    return (char *) mem_region_hi(heap_region()) + 1;
+}
+
+#endif
 
 
 /* function protocals */
@@ -144,6 +442,31 @@ void addtoSeg(char *bp, size_t size);
 int getlistNum(size_t size);
 void *find (size_t size);
 void *search (size_t startlist, size_t size);
+void *place(void *bp, size_t asize);
+#ifdef PAGERUN
+static bool run_init(void);
+static void run_reset(void);
+#endif
+#ifdef PACKEDBINS
+static bool bin_init(void);
+static void bin_reset(void);
+#endif
+#ifdef MM_THREADS
+static bool mt_reset(void);
+#endif
+#ifdef BUDDY
+static void buddy_reset(void);
+#endif
+#ifndef OOBMETA
+static void reset_take(void);
+#endif
+#ifdef LIFETIME
+static bool life_init(void);
+static void life_reset(void);
+#endif
+#ifdef OOBMETA
+static bool oob_init(void);
+#endif
 
 
 
@@ -153,17 +476,28 @@ void *search (size_t startlist, size_t size);
  */
 bool mm_init(void)
 {  
+#if defined(DRIVER) && !defined(MEM_EMULATE)
+    if (mem_sparse()) {          // this build reads and writes heap words directly, which fault on a sparse heap
+        return false;
+    }
+#endif
+#ifdef OOBMETA
+    return oob_init();
+#else
    
-    if ((list_header_ptr = mem_sbrk(SEGLISTNUM * WSIZE)) == (void *)-1){  // first extend the heap to fit all roots for seglists to store the first blk addresses in each seglists
-         return -1;                                                       // list_header_ptr is the first byte of the address of the first root
+    if ((list_header_ptr = mem_sbrk(ROOTS * ROOTWORDS * WSIZE)) == (void *)-1){  // first extend the heap to fit all roots for seglists to store the first blk addresses in each seglists
+         return false;                                                    // list_header_ptr is the first byte of the address of the first root
     }
    
-    for (int i = 0; i < SEGLISTNUM; i++) {
+    for (int i = 0; i < ROOTS * ROOTWORDS; i++) {
          PUT_ADDRESS(list_header_ptr + (i * WSIZE), NULL);    // initialize the roots of seg lists to point to NULL because there is no free blk in them
     }
+#ifdef ADDRORDER
+    skip_seed = 1;                // same towers on every run so the driver's runs are comparable
+#endif
     
     if ((heap_listp = mem_sbrk(4 * WSIZE)) == (void *)-1){   // following text book to initialize the heap
-        return -1;
+        return false;
     }
     
     PUT(heap_listp, 0);
@@ -172,14 +506,183 @@ bool mm_init(void)
     PUT(heap_listp + (3 * WSIZE), PACK(0, 2|1));   // Epilogue header
     
     heap_listp += 4 * WSIZE;
+    grow_peak = 0;
+    grow_step = 0;
+#ifdef PAGERUN
+    if (!run_init()) {
+        return false;
+    }
+#endif
+#ifdef PACKEDBINS
+    if (!bin_init()) {
+        return false;
+    }
+#endif
+#ifdef BUDDY
+    buddy_reset();
+#endif
+#ifdef MM_THREADS
+    if (!mt_reset()) {
+        return false;
+    }
+#endif
     
     // extend the empty heap with a free blk of chunksize bytes
     if (extend_heap(CHUNKSIZE) == NULL){
-        return -1;
+        return false;
+    }
+#ifdef LIFETIME
+    if (!life_init()) {
+        return false;
+    }
+#endif
+    reset_take();
+    return true;
+#endif /* OOBMETA */
+}
+
+/*
+ * mm_reset: empty the heap again, as if mem_reset_brk and mm_init had been called.
+ * mm_init leaves a snapshot of the few heap words it wrote, so a reset is one brk move,
+ * a few small copies and the globals. Without a snapshot of this heap it falls back to mm_init
+ */
+bool mm_reset(void)
+{
+#ifndef OOBMETA
+    if (reset_brk != 0 && reset_lo == (char *) mem_heap_lo()) {
+        size_t used = 0;
+        
+        mem_rewind_brk(reset_brk);
+        for (size_t i = 0; i < reset_nspans; i++) {
+            memcpy(reset_lo + reset_span[i][0], reset_image + used, reset_span[i][1]);
+            used += reset_span[i][1];
+        }
+        wilderness = NULL;
+        grow_peak = 0;
+        grow_step = 0;
+#ifdef ADDRORDER
+        skip_seed = reset_seed;
+#endif
+#ifdef LIFETIME
+        life_reset();             // its seg lists are emptied with the roots
+#endif
+#ifdef PAGERUN
+        run_reset();
+#endif
+#ifdef PACKEDBINS
+        bin_reset();              // the snapshot has no bin arrays, they are built again
+#endif
+#ifdef BUDDY
+        buddy_reset();
+#endif
+#ifdef MM_THREADS
+        return mt_reset();
+#endif
+        return true;
+    }
+#endif
+    mem_reset_brk();
+    return mm_init();
+}
+
+/*
+ * mm_attach: take over the heap memlib has mapped again from its file (mem_remap, or a file an earlier run left),
+ * as mm_init and the calls since left it. Every link in it is an offset, so only the globals are rebuilt.
+ * Returns false if the heap was never set up by mm_init, or if the build stores absolute addresses
+ */
+bool mm_attach(void)
+{
+#ifdef PERSIST
+    char *lo = mem_heap_lo();
+
+    if (mem_heapsize() < ROOTS * ROOTWORDS * WSIZE + 4 * WSIZE
+        || GET(lo + ROOTS * ROOTWORDS * WSIZE + 2 * WSIZE) != PACK(DSIZE, 1)) {   // no prologue where mm_init puts it
+        return false;
+    }
+    list_header_ptr = lo;
+    heap_listp = lo + ROOTS * ROOTWORDS * WSIZE + 4 * WSIZE;
+    wilderness = NULL;
+    life_class = 0;
+    grow_peak = 0;
+    grow_step = 0;
+    return true;
+#else
+    return false;
+#endif
+}
+
+/*
+ * traffic_kind: charge memlib's traffic counters to kind from now on and return the kind before,
+ * nothing at all unless built with MEM_TRAFFIC
+ */
+static int traffic_kind(int kind)
+{
+#ifdef MEM_TRAFFIC
+    return mem_traffic_kind(kind);
+#else
+    return kind;
+#endif
+}
+
+
+#ifndef OOBMETA
+
+/*
+ * reset_save: add the len bytes at p to the snapshot, false if it is full
+ */
+
+static bool reset_save(char *p, size_t len)
+{
+    size_t off = p - (char *) mem_heap_lo();
+    size_t last = reset_nspans - 1;
+    
+    if (reset_used + len > RESET_BYTES) {
+        return false;
+    }
+    if (reset_nspans > 0 && reset_span[last][0] + reset_span[last][1] == off) {
+        reset_span[last][1] += len;            // continues the last run
+    } else if (reset_nspans < RESET_SPANS) {
+        reset_span[reset_nspans][0] = off;
+        reset_span[reset_nspans][1] = len;
+        reset_nspans++;
+    } else {
+        return false;
     }
+    memcpy(reset_image + reset_used, p, len);
+    reset_used += len;
     return true;
 }
 
+/*
+ * reset_take: snapshot the heap right after mm_init for mm_reset: the roots and prologue,
+ * every allocated blk, and of a free blk only its header, list links and footer
+ */
+
+static void reset_take(void)
+{
+    size_t links = ROOTWORDS > 2 ? ROOTWORDS : 2;   // payload words the seg lists may use in a free blk
+    size_t size;
+    char *bp;
+    bool ok;
+    
+    reset_nspans = 0;
+    reset_used = 0;
+    ok = reset_save(mem_heap_lo(), HDRP(heap_listp) - (char *) mem_heap_lo());
+    for (bp = heap_listp; ok && (size = GET_SIZE(HDRP(bp))) > 0; bp = NEXT_BLK(bp)) {
+        if (GET_ALLOC(HDRP(bp))) {
+            ok = reset_save(HDRP(bp), size);
+        } else {
+            ok = reset_save(HDRP(bp), WSIZE + (links*WSIZE < size - DSIZE ? links*WSIZE : size - DSIZE))
+                 && reset_save(FTRP(bp), WSIZE);
+        }
+    }
+    ok = ok && reset_save(HDRP(bp), WSIZE);         // epilogue
+    reset_lo = mem_heap_lo();
+    reset_brk = ok ? mem_heapsize() : 0;
+#ifdef ADDRORDER
+    reset_seed = skip_seed;
+#endif
+}
 
 /*
  * extend_heap: called from malloc ot init to increase the heap
@@ -189,20 +692,295 @@ void *extend_heap(size_t words)
 {
     char *bp;
     
-    if ((long) (bp = mem_sbrk(words)) < 0){                // bp is pointing to the next byte of heap_high which is the first byte of the new block payload
+    if ((long) (bp = mem_region_sbrk(heap_region(), words)) < 0){    // bp is pointing to the next byte of heap_high which is the first byte of the new block payload
 	      return NULL;                                       // so we have to use HDRP to find header position and then set it 
     }  
     
-    PUT(HDRP(bp), PACK(words, PREV_ALLOC(HDRP(bp))));      //Setting the new block header
+    PUT(HDRP(bp), PACK(words, PREV_ALLOC(HDRP(bp)) | life_class));    //Setting the new block header, of the class being served
     PUT(FTRP(bp), GET(HDRP(bp)));                          //Setting the new block footer
+    PUT(HDRP(NEXT_BLK(bp)), PACK(0, 1));                   //new epilogue header
                               
     addtoSeg(bp, words);                                   //add newly allocated blk to a free list which is fit for its size because we have to place it in malloc
-    PUT(HDRP(NEXT_BLK(bp)), PACK(0, 1));                   //new epilogue header
     
     return coalesce(bp);                                   //try to coalesce
 }
 
 
+#ifdef ADDRORDER
+
+/*
+ * skip_level: draw the tower height of a new free blk, each extra level with probability 1/4,
+ * but never more levels than the blk has words between its header and footer
+ */
+
+static int skip_level(size_t size)
+{
+    int room = (size - DSIZE) / WSIZE;
+    int level = 1;
+    
+    if (room > SKIPLEVELS) {
+        room = SKIPLEVELS;
+    }
+    skip_seed ^= skip_seed << 13;      // xorshift32
+    skip_seed ^= skip_seed >> 17;
+    skip_seed ^= skip_seed << 5;
+    while (level < room && ((skip_seed >> (2 * level)) & 3) == 0) {
+        level++;
+    }
+    return level;
+}
+
+/*
+ * skip_find: fill update[l] with the last node on level l whose address is below bp.
+ * the root is laid out like a blk with SKIPLEVELS links, so it is the first node on every level
+ */
+
+static void skip_find(char *root, char *bp, char **update)
+{
+    char *x = root, *next;
+    
+    for (int l = SKIPLEVELS - 1; l >= 0; l--) {
+        while ((next = GET_ADDRESS(x + l*WSIZE)) != NULL && next < bp) {
+            x = next;
+        }
+        update[l] = x;
+    }
+}
+
+/*
+ * addtoseg: insert bp into its seg list in address order, O(log n) expected
+ */
+
+void addtoSeg(char *bp, size_t size)
+{
+    char *update[SKIPLEVELS];
+    int level = skip_level(size);
+    
+    skip_find(ROOT(getlistNum(size)), bp, update);
+    for (int l = 0; l < level; l++) {
+        PUT_ADDRESS(bp + l*WSIZE, GET_ADDRESS(update[l] + l*WSIZE));   // link level l of bp after its predecessor
+        PUT_ADDRESS(update[l] + l*WSIZE, bp);
+    }
+}
+
+/*
+ * remfromseg: unlink bp from every level it is on. There are no back links,
+ * so the predecessors are found by the same top-down walk as an insert
+ */
+
+void remfromSeg(char *bp, size_t size)
+{
+    char *update[SKIPLEVELS];
+    
+    skip_find(ROOT(getlistNum(size)), bp, update);
+    for (int l = 0; l < SKIPLEVELS; l++) {
+        if (GET_ADDRESS(update[l] + l*WSIZE) != bp) {   // bp's tower is lower than l
+            break;
+        }
+        PUT_ADDRESS(update[l] + l*WSIZE, GET_ADDRESS(bp + l*WSIZE));
+    }
+}
+
+#elif defined(PACKEDBINS)
+
+static uint32_t *CHUNK_SIZES(char *chunk)   // sizes in granules, right after the link and count words
+{
+    return (uint32_t *) (chunk + 2*WSIZE);
+}
+
+static char *CHUNK_PTRS(char *chunk)        // blk pointers, after the sizes
+{
+    return chunk + 2*WSIZE + BIN_LANES * sizeof(uint32_t);
+}
+
+static uint32_t GRANULES(size_t size)
+{
+    return (size >> 4) < GRANULE_MAX ? (uint32_t) (size >> 4) : GRANULE_MAX;
+}
+
+/*
+ * bin_find: follow the chain from chunk to the first chunk holding a size of at least min granules,
+ * return it with the matching lanes in *mask, or NULL.
+ * lanes past the count of a chunk hold 0, so a whole chunk is always compared
+ */
+
+static char *bin_find_scalar(char *chunk, uint32_t min, unsigned *mask)
+{
+    for (; chunk != NULL; chunk = GET_ADDRESS(chunk)) {
+        *mask = 0;
+        for (int lane = 0; lane < BIN_LANES; lane++) {
+            *mask |= (unsigned) (CHUNK_SIZES(chunk)[lane] >= min) << lane;
+        }
+        if (*mask) {
+            return chunk;
+        }
+    }
+    return NULL;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+static char *bin_find_sse2(char *chunk, uint32_t min, unsigned *mask)
+{
+    __m128i key = _mm_set1_epi32((int) (min - 1));   // sizes and min are below 2^31, so signed compare is fine
+    const __m128i *sizes;
+    
+    for (; chunk != NULL; chunk = GET_ADDRESS(chunk)) {
+        sizes = (const __m128i *) CHUNK_SIZES(chunk);
+        *mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(_mm_loadu_si128(sizes), key)))
+              | _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(_mm_loadu_si128(sizes + 1), key))) << 4;
+        if (*mask) {
+            return chunk;
+        }
+    }
+    return NULL;
+}
+
+__attribute__((target("avx2")))
+static char *bin_find_avx2(char *chunk, uint32_t min, unsigned *mask)
+{
+    __m256i key = _mm256_set1_epi32((int) (min - 1));
+    
+    for (; chunk != NULL; chunk = GET_ADDRESS(chunk)) {
+        *mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i *) CHUNK_SIZES(chunk)), key)));
+        if (*mask) {
+            return chunk;
+        }
+    }
+    return NULL;
+}
+
+#endif
+
+static char *(*bin_find)(char *chunk, uint32_t min, unsigned *mask) = bin_find_scalar;
+
+/*
+ * addtoseg: put bp in the last lane of the newest chunk of its bin, taking a chunk from the pool
+ * or the bin region when that one is full, and store the chunk and lane in the blk
+ */
+
+void addtoSeg(char *bp, size_t size)
+{
+    int id = getlistNum(size);
+    char *chunk = GET_ADDRESS(ROOT(id));
+    size_t n;
+    
+    if (chunk == NULL || GET(chunk + WSIZE) == BIN_LANES) {
+        char *fresh = bin_pool;
+        
+        if (fresh != NULL) {
+            bin_pool = GET_ADDRESS(fresh);
+        } else if ((fresh = mem_region_sbrk(bin_region, BIN_CHUNK)) == (void *)-1) {
+            return;                       // out of memory: the blk is lost to the allocator but the heap stays valid
+        }
+        PUT_ADDRESS(fresh, chunk);
+        PUT(fresh + WSIZE, 0);
+        memset(CHUNK_SIZES(fresh), 0, BIN_LANES * sizeof(uint32_t));
+        PUT_ADDRESS(ROOT(id), fresh);
+        chunk = fresh;
+    }
+    n = GET(chunk + WSIZE);
+    CHUNK_SIZES(chunk)[n] = GRANULES(size);
+    PUT_ADDRESS(CHUNK_PTRS(chunk) + n*WSIZE, bp);
+    PUT(N_ADD(bp), (size_t) chunk + n);   // chunks are 16-byte aligned, the lane fits in the low bits
+    PUT(chunk + WSIZE, n + 1);
+}
+
+/*
+ * remfromseg: move the newest slot of the bin into the slot of bp, an emptied chunk goes back to the pool
+ */
+
+void remfromSeg(char *bp, size_t size)
+{
+    int id = getlistNum(size);
+    char *tail = GET_ADDRESS(ROOT(id));
+    size_t last = GET(tail + WSIZE) - 1;
+    size_t slot = GET(N_ADD(bp));
+    char *chunk = (char *) (slot & ~(size_t) (BIN_LANES - 1));
+    size_t lane = slot & (BIN_LANES - 1);
+    char *moved = GET_ADDRESS(CHUNK_PTRS(tail) + last*WSIZE);
+    
+    CHUNK_SIZES(chunk)[lane] = CHUNK_SIZES(tail)[last];
+    PUT_ADDRESS(CHUNK_PTRS(chunk) + lane*WSIZE, moved);
+    PUT(N_ADD(moved), slot);
+    CHUNK_SIZES(tail)[last] = 0;          // keep the unused lanes at 0 for bin_find
+    PUT(tail + WSIZE, last);
+    if (last == 0) {
+        PUT_ADDRESS(ROOT(id), GET_ADDRESS(tail));
+        PUT_ADDRESS(tail, bin_pool);
+        bin_pool = tail;
+    }
+}
+
+/*
+ * bin_reset: empty the bin region, pick the widest compare the cpu supports,
+ * and put the free blks of the heap, if it has any yet, into new bins
+ */
+
+static void bin_reset(void)
+{
+    char *bp;
+    
+    mem_region_rewind(bin_region, 0);
+    bin_pool = NULL;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    bin_find = __builtin_cpu_supports("avx2") ? bin_find_avx2 : bin_find_sse2;
+#endif
+    for (int i = 0; i < ROOTS; i++) {
+        PUT_ADDRESS(ROOT(i), NULL);
+    }
+    for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLK(bp)) {
+        if (!GET_ALLOC(HDRP(bp))) {
+            addtoSeg(bp, GET_SIZE(HDRP(bp)));
+        }
+    }
+}
+
+/*
+ * bin_init: create the bin region
+ */
+
+static bool bin_init(void)
+{
+    if ((bin_region = mem_region_create(BIN_REGION)) < 0) {
+        return false;
+    }
+    bin_reset();
+    return true;
+}
+
+/*
+ * search: compare the chunks of a bin, newest first, for a free blk of at least size bytes
+ */
+
+void *search (size_t startlist, size_t size)
+{
+    char *end = heap_end();
+    char *chunk, *current;
+    uint32_t min = GRANULES(size);
+    unsigned mask;
+    size_t csize;
+    int lane;
+    
+    for (chunk = bin_find(GET_ADDRESS(ROOT(startlist)), min, &mask); chunk != NULL; chunk = bin_find(GET_ADDRESS(chunk), min, &mask)) {
+        for (; mask != 0; mask &= ~(1u << lane)) {
+            lane = 31 - __builtin_clz(mask);          // the highest lane was freed last
+            current = GET_ADDRESS(CHUNK_PTRS(chunk) + lane*WSIZE);
+            csize = GET_SIZE(HDRP(current));
+            if (size <= csize) {          // fails only for saturated sizes
+                if (current + csize != end) {
+                    return current;
+                }
+                wilderness = current;
+            }
+        }
+    }
+    return NULL;
+}
+
+#else
+
 /*
  * addtoseg: pass in blk pointer and add this blk to be the first in the fit free list
  */
@@ -211,10 +989,10 @@ void *extend_heap(size_t words)
 void addtoSeg(char *bp, size_t size)
 {   
     char *first, *start;
-    int id = getlistNum(size);  // calculate the seg list ID number that should be added to
+    int id = getlistNum(size) + (LIFE(HDRP(bp)) ? SEGLISTNUM : 0);  // calculate the seg list ID number that should be added to
     
-    start = list_header_ptr + id*WSIZE;    // this is the root of the that fit free list
-    first = (char *) GET(start);           // this is address of currrent first blk this free list
+    start = ROOT(id);    // this is the root of the that fit free list
+    first = GET_ADDRESS(start);           // this is address of currrent first blk this free list
     
     if ( first == NULL )         // if this free list is empty, put bp in the root of this free list so that next and prev is pointing to null
     {    
@@ -237,17 +1015,17 @@ void addtoSeg(char *bp, size_t size)
 
 void remfromSeg(char *bp, size_t size)
 {
-    char *next = (char *) GET(N_ADD(bp));    // address of next blk in seg list
-    char *prev = (char *) GET(P_ADD(bp));
+    char *next = GET_ADDRESS(N_ADD(bp));    // address of next blk in seg list
+    char *prev = GET_ADDRESS(P_ADD(bp));
     
-    int startinglist = getlistNum(size);      // calculate the seg list ID number that should be removed from
+    int startinglist = getlistNum(size) + (LIFE(HDRP(bp)) ? SEGLISTNUM : 0);      // calculate the seg list ID number that should be removed from
     
     if (prev == NULL && next != NULL) {                        // case1: this blk is the first blk in this seg list
-      PUT_ADDRESS(list_header_ptr + startinglist*WSIZE, next); // put the address of second blk into the root of seg list
+      PUT_ADDRESS(ROOT(startinglist), next);         // put the address of second blk into the root of seg list
       PUT_ADDRESS(P_ADD(next), NULL);                          // set the previous blk of the new root to be null
 
     } else if (prev == NULL && next == NULL) {      
-      PUT_ADDRESS(list_header_ptr + startinglist*WSIZE, NULL);     // case2: the empty seg list. 
+      PUT_ADDRESS(ROOT(startinglist), NULL);             // case2: the empty seg list. 
       
     } else if (prev != NULL && next == NULL) {              // case3: blk is at the end of the seg list
       PUT_ADDRESS(N_ADD(prev), NULL);                       // set the previous blk's next to be NULL
@@ -259,25 +1037,32 @@ void remfromSeg(char *bp, size_t size)
     }
 }
 
+#endif /* ADDRORDER, PACKEDBINS */
+
 /*
  * find: using sizeof blk to search a free blk
+ * the free blk right before the epilogue (the wilderness) is only used when no other blk fits,
+ * so that the end of the heap stays one contiguous run that extend_heap can grow
  */
 
 void *find (size_t size)
 {
-     int i, startinglist= getlistNum(size);    // calculate the smallest seg list ID which its size can fit our request
+     int first = life_class ? SEGLISTNUM : 0;     // seg lists of the class being served
+     int i, startinglist= first + getlistNum(size);    // calculate the smallest seg list ID which its size can fit our request
      char *bp ;
      
-     
-     for (i = startinglist; i < SEGLISTNUM; i++) {    //search through all seg list whihch its ID is larger than "startinglist"
+     wilderness = NULL;
+     for (i = startinglist; i < first + SEGLISTNUM; i++) {    //search through all seg list whihch its ID is larger than "startinglist"
          if ((bp = search(i, size)) != NULL){
              
              return bp;  // if find one, return that blk
          }  
 	   }
-     return NULL;
+     return wilderness;   // allocation of last resort, NULL if the wilderness does not fit either
 }
 
+#ifndef PACKEDBINS
+
 /*
  * search:  search through a given seg list for free blk
  */
@@ -285,19 +1070,26 @@ void *find (size_t size)
 void *search (size_t startlist, size_t size)    
 {
 
-     char *current = (char *) GET( list_header_ptr + startlist*WSIZE ); // let current be the address of first blk in this list
+     char *current = GET_ADDRESS( ROOT(startlist) ); // let current be the address of first blk in this list
+     char *end = heap_end();                       // a blk is the wilderness if its next blk is the epilogue at the end of heap
+     size_t csize;
 
      while (current != NULL){                  // we search through this list to find first fit free blk
-         if (size <= GET_SIZE(HDRP(current)) ){
-              
-              break;
+         csize = GET_SIZE(HDRP(current));
+         if (size <= csize ){
+              if (current + csize != end){
+                  break;
+              }
+              wilderness = current;            // remember it but keep looking for a blk that is not at the end of heap
          } 
-         current = (char *) GET(N_ADD(current)); // let current point to the next blk in this free list
+         current = GET_ADDRESS(N_ADD(current)); // let current point to the next blk in this free list
          
      }
      return current;
 }
 
+#endif /* !PACKEDBINS */
+
 
 /*
  * coalesce: try to coalesce the previous and next blk in heap
@@ -324,8 +1116,8 @@ void *coalesce(void *bp)
          remfromSeg(next, GET_SIZE(HDRP(next))); // remove bp blk and next from their free lists
          
          size += GET_SIZE(HDRP(next));
-         PUT(HDRP(bp), PACK(size, prev_alloc));
-         PUT(FTRP(bp), PACK(size, prev_alloc));  // set this new large blk 's header and footer
+         PUT(HDRP(bp), PACK(size, prev_alloc | LIFE(HDRP(bp))));
+         PUT(FTRP(bp), GET(HDRP(bp)));  // set this new large blk 's header and footer
          
          addtoSeg(bp, size);// add it to a free list
          return bp;
@@ -339,7 +1131,7 @@ void *coalesce(void *bp)
          
          size = size + prevsize;
          
-         PUT(HDRP(prev), PACK(size, PREV_ALLOC(HDRP(prev))));
+         PUT(HDRP(prev), PACK(size, PREV_ALLOC(HDRP(prev)) | LIFE(HDRP(bp))));
          PUT(FTRP(prev), GET(HDRP(prev)));            // set this new large blk 's header and footer
          addtoSeg(prev, size);      // add it to a free list
          
@@ -360,7 +1152,7 @@ void *coalesce(void *bp)
          
          size += prevsize + nextsize;
          
-         PUT(prevheader, PACK(size, PREV_ALLOC(prevheader)));
+         PUT(prevheader, PACK(size, PREV_ALLOC(prevheader) | LIFE(HDRP(bp))));
          PUT(FTRP(prev), GET(prevheader));      // set this new large blk 's header and footer
          addtoSeg(prev, size);      // add it to a free list
          
@@ -371,31 +1163,45 @@ void *coalesce(void *bp)
 
 /*
  * place: place a blk: remove a blk from seg list and split it if possible
+ * small requests are carved from the back of the free blk so the front part stays one large free run,
+ * unless the blk is the wilderness, which always gives away its front so the end of heap stays free.
+ * return the payload address of the allocated blk
  */
 
 
-void place(void *bp, size_t asize)
+void *place(void *bp, size_t asize)
 {
     size_t rsize = GET_SIZE(HDRP(bp));
     size_t remainsize = rsize - asize;
     char *next = NEXT_BLK(bp);
+    char *alloc;
     
     remfromSeg(bp, rsize); //remove bp blk from list
     
-    if (remainsize >= 2*DSIZE) {    // if the real size - size is grater than 32 B and we split it into  two plk
-	      PUT(HDRP(bp), PACK(asize, PREV_ALLOC(HDRP(bp)) | 1));    //reset the size and allocation bit
+    if (remainsize >= 2*DSIZE && asize <= SMALLBLK && GET_SIZE(HDRP(next)) != 0) {  // split at the back: the free part keeps the front of the blk
+        PUT(HDRP(bp), PACK(remainsize, PREV_ALLOC(HDRP(bp)) | LIFE(HDRP(bp))));
+        PUT(FTRP(bp), GET(HDRP(bp)));                // set header and footer of the free blk we left at the front
+        addtoSeg(bp, remainsize);
+        alloc = NEXT_BLK(bp);
+        PUT(HDRP(alloc), PACK(asize, 1 | LIFE(HDRP(bp))));    // previous blk is free, so only the alloc bit is set
+        PUT(HDRP(next), GET(HDRP(next)) | 2);         // the blk after us now has an allocated previous blk
+        return alloc;
+        
+    } else if (remainsize >= 2*DSIZE) {    // if the real size - size is grater than 32 B and we split it into  two plk
+	      PUT(HDRP(bp), PACK(asize, PREV_ALLOC(HDRP(bp)) | LIFE(HDRP(bp)) | 1));    //reset the size and allocation bit
 	      next = NEXT_BLK(bp);
-	      PUT(HDRP(next), remainsize | 2);
-	      PUT(FTRP(next), remainsize | 2); // set header and footer of the blk we splited
+	      PUT(HDRP(next), remainsize | LIFE(HDRP(bp)) | 2);
+	      PUT(FTRP(next), GET(HDRP(next))); // set header and footer of the blk we splited
 	      addtoSeg(next, remainsize); //add this newly splited blk to seg list
         
              
     } else {
-	      PUT(HDRP(bp), PACK(rsize, PREV_ALLOC(HDRP(bp)) | 1));  // if the real size - size is smaller than 32 B and we don't split it into two plk
+	      PUT(HDRP(bp), PACK(rsize, PREV_ALLOC(HDRP(bp)) | LIFE(HDRP(bp)) | 1));  // if the real size - size is smaller than 32 B and we don't split it into two plk
         PUT(HDRP(next), GET(HDRP(next)) | 2);  // set header and footer of the bp blk and next blk
       	if (!GET_ALLOC(HDRP(next)))
       	    PUT(FTRP(next), GET(HDRP(next)));
       }
+    return bp;
   }
 
 
@@ -403,60 +1209,1515 @@ void place(void *bp, size_t asize)
 
 
 /*
- * malloc
+ * grow_size: how much to extend the heap by when extend bytes are missing.
+ * below the peak given to mm_hint_peak, grow by at least grow_step but never past the peak,
+ * so a heap that is known to get big does not get there one small mem_sbrk and coalesce at a time.
+ * a heap on huge pages always ends on a huge page boundary, so the blks are packed into whole huge pages
  */
-void* malloc(size_t size)
+
+static size_t grow_size(size_t extend)
 {
+    size_t heap = mem_region_size(heap_region());
+    size_t huge = mem_hugepage_size();
     
-    
-    size_t asize;
-    char *bp;
-    
-    if (size <= 0){
-	      return NULL;
+    if (extend < grow_step && heap + extend < grow_peak && heap_region() == 0) {    // the peak is that of the heap
+        extend = heap + grow_step <= grow_peak ? grow_step : grow_peak - heap;
     }
-    
-    asize = DSIZE * ((size+(DSIZE)+(DSIZE-1))/DSIZE); // adjust the size to make it no less than 32 B
+    if (huge != 0) {
+        extend = ((heap + extend + huge - 1) & ~(huge - 1)) - heap;
+    }
+    return extend;
+}
 
+#ifdef LIFETIME
+
+/*
+ * life_reset: empty the short-lived region, leaving a prologue and an epilogue like the heap's;
+ * it gets its first free blk from the first short-lived request that extends it
+ */
+
+static void life_reset(void)
+{
+    char *p = mem_region_lo(life_region);
+    
+    mem_region_rewind(life_region, 4 * WSIZE);
+    PUT(p, 0);
+    PUT(p + (1 * WSIZE), PACK(DSIZE, 1));          // alignment padding
+    PUT(p + (2 * WSIZE), PACK(DSIZE, 1));          // prologue header
+    PUT(p + (3 * WSIZE), PACK(0, 2|1));            // epilogue header
+    life_listp = p + 4 * WSIZE;
+}
+
+/*
+ * life_init: create the short-lived region
+ */
+
+static bool life_init(void)
+{
+    if ((life_region = mem_region_create(LIFE_REGION)) < 0
+        || mem_region_sbrk(life_region, 4 * WSIZE) == (void *)-1) {
+        return false;
+    }
+    life_reset();
+    return true;
+}
+
+#endif /* LIFETIME */
+
+/*
+ * blk_alloc: find or make a free blk of asize bytes (header included) and allocate it
+ */
+
+static void *blk_alloc(size_t asize)
+{
+    size_t extend;
+    char *bp, *epilogue;
     
     if ((bp = find(asize)) != NULL) { // call find to find a free blk and then place it
-        place(bp, asize);
-	      return bp;
+	      return place(bp, asize);
+    }
+    
+    epilogue = heap_end() - WSIZE;
+    if (!PREV_ALLOC(epilogue)) {      // the wilderness is free but too small: only grow the heap by what is missing
+        extend = asize - GET_SIZE(epilogue - WSIZE);
+        if (extend < 2*DSIZE) {       // extend_heap needs room for the header, footer and list links
+            extend = 2*DSIZE;
+        }
+    } else {
+        extend = asize;
+    }
+    extend = grow_size(extend);
+ 
+    if ((bp = extend_heap(extend)) == NULL){ // if no fit free blk, extend the heap
+        return NULL;
+    }
+    return place(bp, asize);
+}
+
+/*
+ * blk_free: give an allocated blk back to the seg lists
+ */
+
+static void blk_free(void *ptr)
+{
+    size_t size;
+    char *next;
+    
+    size = GET_SIZE(HDRP(ptr));
+    next = NEXT_BLK(ptr);
+    PUT(HDRP(ptr), GET(HDRP(ptr)) & ~(GROWN_BIT | 0x1)); // set the ptr blk not allocated  for header, footer and next blk's header and footer
+    PUT(FTRP(ptr), GET(HDRP(ptr)));
+    PUT(HDRP(next), GET(HDRP(next)) & ~0x2);
+    
+    addtoSeg(ptr, size);     // add freed blk to seg list
+    coalesce(ptr);          //try to coalesce
+}
+
+/*
+ * blk_adjust: size of the blk that holds a payload of size bytes, no less than 32 B
+ */
+
+static size_t blk_adjust(size_t size)
+{
+    return DSIZE * ((size+(DSIZE)+(DSIZE-1))/DSIZE);
+}
+
+/*
+ * release_front: turn the first front bytes of allocated blk bp into a free blk, return the rest
+ */
+
+static char *release_front(char *bp, size_t front)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    char *nbp = bp + front;
+    
+    PUT(HDRP(bp), PACK(front, PREV_ALLOC(HDRP(bp)) | LIFE(HDRP(bp))));
+    PUT(FTRP(bp), GET(HDRP(bp)));
+    PUT(HDRP(nbp), PACK(size - front, LIFE(HDRP(bp)) | 1));       // previous blk is free now
+    addtoSeg(bp, front);
+    coalesce(bp);
+    return nbp;
+}
+
+/*
+ * release_tail: shrink allocated blk bp to asize bytes and free what is left, if that is a whole blk
+ */
+
+static void release_tail(char *bp, size_t asize)
+{
+    size_t size = GET_SIZE(HDRP(bp));
+    char *tail, *next;
+    
+    if (size - asize < 2*DSIZE) {
+        return;
+    }
+    PUT(HDRP(bp), PACK(asize, PREV_ALLOC(HDRP(bp)) | LIFE(HDRP(bp)) | 1));
+    tail = NEXT_BLK(bp);
+    PUT(HDRP(tail), PACK(size - asize, LIFE(HDRP(bp)) | 2));
+    PUT(FTRP(tail), GET(HDRP(tail)));
+    next = NEXT_BLK(tail);
+    PUT(HDRP(next), GET(HDRP(next)) & ~0x2);     // blk after the tail has a free previous blk now
+    addtoSeg(tail, size - asize);
+    coalesce(tail);
+}
+
+/*
+ * blk_alloc_aligned: allocate a blk whose payload is a multiple of align (a power of two >= ALIGNMENT)
+ * by over-allocating, then giving the misaligned front and the unused tail back to the seg lists
+ */
+
+static void *blk_alloc_aligned(size_t align, size_t size)
+{
+    size_t asize = blk_adjust(size);
+    size_t front;
+    char *bp;
+    
+    if (align <= ALIGNMENT) {
+        return blk_alloc(asize);
+    }
+    if ((bp = blk_alloc(asize + align + 2*DSIZE)) == NULL) {
+        return NULL;
+    }
+    front = (align - ((size_t) bp & (align - 1))) & (align - 1);
+    if (front != 0 && front < 2*DSIZE) {          // the front piece has to be big enough to be a free blk
+        front += align;
+    }
+    if (front != 0) {
+        bp = release_front(bp, front);
+    }
+    release_tail(bp, asize);
+    return bp;
+}
+
+/*
+ * blk_realloc: resize allocated blk bp to hold size bytes, in place when it can.
+ * A shrinking blk gives its tail back. A growing blk first takes in the free blk after it, growing the heap
+ * if it is the last blk, and is moved only if that is not enough. A blk that has been grown before is given
+ * half as much again as asked for, so a blk that keeps growing by a little stays where it is most of the time
+ */
+static void *blk_realloc(char *bp, size_t size)
+{
+    size_t asize = blk_adjust(size);
+    size_t csize = GET_SIZE(HDRP(bp));
+    size_t target = GET(HDRP(bp)) & GROWN_BIT ? blk_adjust(size + size / 2) : asize;
+    char *next = NEXT_BLK(bp);
+    char *nbp;
+    size_t class;
+    int kind;
+    
+    if (asize <= csize) {
+        release_tail(bp, asize);
+        return bp;
+    }
+    if (GET_SIZE(HDRP(next)) == 0 || (!GET_ALLOC(HDRP(next)) && GET_SIZE(HDRP(NEXT_BLK(next))) == 0
+                                      && csize + GET_SIZE(HDRP(next)) < target)) {
+        size_t have = GET_ALLOC(HDRP(next)) ? 0 : GET_SIZE(HDRP(next));
+        size_t extend = target - csize - have;    // bp ends the heap, or only a too small wilderness follows it
+        if (extend < 2*DSIZE) {
+            extend = 2*DSIZE;
+        }
+        class = life_class;
+        life_class = LIFE(HDRP(bp));              // grow the region bp lies in
+        nbp = extend_heap(grow_size(extend));     // the peak hint and huge pages apply as in blk_alloc, release_tail frees the excess
+        life_class = class;
+        if (nbp == NULL) {
+            return NULL;
+        }
+    }
+    if (!GET_ALLOC(HDRP(next)) && csize + GET_SIZE(HDRP(next)) >= asize) {
+        size_t nsize = GET_SIZE(HDRP(next));
+        remfromSeg(next, nsize);
+        PUT(HDRP(bp), PACK(csize + nsize, GET(HDRP(bp)) & 0xF));
+        next = NEXT_BLK(bp);
+        PUT(HDRP(next), GET(HDRP(next)) | 2);     // the blk after the free one has an allocated previous blk now
+        release_tail(bp, target < csize + nsize ? target : csize + nsize);
+        PUT(HDRP(bp), GET(HDRP(bp)) | GROWN_BIT);
+        return bp;
+    }
+    if ((nbp = blk_alloc(target)) == NULL) {
+        return NULL;
+    }
+    kind = traffic_kind(MEM_KIND_REALLOC);
+    memcpy(nbp, bp, csize - WSIZE);
+    traffic_kind(kind);
+    blk_free(bp);
+    PUT(HDRP(nbp), GET(HDRP(nbp)) | GROWN_BIT);
+    return nbp;
+}
+
+
+#endif /* !OOBMETA */
+
+#ifdef BUDDY
+
+static char *buddy_roots[BUDDY_TOP + 1];       // free blocks of every order, over all arenas
+static char *buddy_reg = NULL;                 // allocated blk: count, capacity, sorted arena addresses
+
+static char *BUDDY_FREE(char *a) { return a; }
+static char *BUDDY_SPLIT(char *a) { return a + BUDDY_MAP; }
+static size_t BUDDY_USED(char *a) { return GET(a + 2*BUDDY_MAP); }
+
+static size_t buddy_bit(char *map, size_t n)
+{
+    return (GET(map + (n / 64)*WSIZE) >> (n % 64)) & 1;
+}
+
+static void buddy_put(char *map, size_t n, size_t val)
+{
+    char *w = map + (n / 64)*WSIZE;
+    size_t mask = (size_t) 1 << (n % 64);
+    PUT(w, val ? GET(w) | mask : GET(w) & ~mask);
+}
+
+static char *buddy_addr(char *a, size_t n, int k)     // first byte of block n of order k
+{
+    return a + ((n - ((size_t) 1 << (BUDDY_TOP - k))) << (4 + k));
+}
+
+static void buddy_push(char *b, int k)
+{
+    char *first = buddy_roots[k];
+    
+    PUT_ADDRESS(N_ADD(b), first);
+    PUT_ADDRESS(P_ADD(b), NULL);
+    if (first != NULL) {
+        PUT_ADDRESS(P_ADD(first), b);
+    }
+    buddy_roots[k] = b;
+}
+
+static void buddy_unlink(char *b, int k)
+{
+    char *next = GET_ADDRESS(N_ADD(b));
+    char *prev = GET_ADDRESS(P_ADD(b));
+    
+    if (prev != NULL) {
+        PUT_ADDRESS(N_ADD(prev), next);
+    } else {
+        buddy_roots[k] = next;
+    }
+    if (next != NULL) {
+        PUT_ADDRESS(P_ADD(next), prev);
+    }
+}
+
+/*
+ * buddy_carve: give arena a the blocks of its empty state under block n of order k, or take them back
+ * if release is set. A block is free unless it overlaps the bitmaps or the last 16 bytes, then it is split
+ * down to 16-byte blocks, and those that overlap stay allocated
+ */
+static void buddy_carve(char *a, size_t n, int k, bool release)
+{
+    size_t lo = buddy_addr(a, n, k) - a, hi = lo + ((size_t) DSIZE << k);
+    
+    if (lo >= BUDDY_META && hi <= BUDDY_ARENA - DSIZE) {
+        if (release) {
+            buddy_unlink(a + lo, k);
+        } else {
+            buddy_put(BUDDY_FREE(a), n, 1);
+            buddy_push(a + lo, k);
+        }
+    } else if (k > 0) {
+        buddy_put(BUDDY_SPLIT(a), n, 1);
+        buddy_carve(a, 2*n, k - 1, release);
+        buddy_carve(a, 2*n + 1, k - 1, release);
+    }
+}
+
+/*
+ * buddy_find: index of arena a in the registry, or of where it would go
+ */
+static size_t buddy_find(char *a)
+{
+    size_t lo = 0, hi = buddy_reg == NULL ? 0 : GET(buddy_reg);
+    
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (GET_ADDRESS(buddy_reg + (2 + mid)*WSIZE) < a) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/*
+ * buddy_of: the arena ptr was handed out from, NULL if ptr is not a buddy block
+ */
+static char *buddy_of(void *ptr)
+{
+    char *a = (char *) ((size_t) ptr & ~(size_t) (BUDDY_ARENA - 1));
+    size_t i = buddy_find(a);
+    
+    if (buddy_reg != NULL && i < GET(buddy_reg) && GET_ADDRESS(buddy_reg + (2 + i)*WSIZE) == a) {
+        return a;
+    }
+    return NULL;
+}
+
+/*
+ * buddy_new: take a new arena from the seg lists and register it
+ */
+static bool buddy_new(void)
+{
+    size_t count = buddy_reg == NULL ? 0 : GET(buddy_reg);
+    size_t cap = buddy_reg == NULL ? 0 : GET(buddy_reg + WSIZE);
+    size_t i;
+    char *a, *reg;
+    
+    if (count == cap) {                   // double the registry first
+        cap = cap == 0 ? 8 : 2 * cap;
+        if ((reg = blk_alloc(blk_adjust((2 + cap) * WSIZE))) == NULL) {
+            return false;
+        }
+        PUT(reg, count);
+        PUT(reg + WSIZE, cap);
+        if (buddy_reg != NULL) {
+            memcpy(reg + 2*WSIZE, buddy_reg + 2*WSIZE, count * WSIZE);
+            blk_free(buddy_reg);
+        }
+        buddy_reg = reg;
+    }
+    if ((a = blk_alloc_aligned(BUDDY_ARENA, BUDDY_ARENA - DSIZE)) == NULL) {   // a blk of exactly BUDDY_ARENA bytes
+        return false;
+    }
+    i = buddy_find(a);
+    memmove(buddy_reg + (3 + i)*WSIZE, buddy_reg + (2 + i)*WSIZE, (count - i) * WSIZE);
+    PUT_ADDRESS(buddy_reg + (2 + i)*WSIZE, a);
+    PUT(buddy_reg, count + 1);
+    memset(a, 0, BUDDY_META);
+    buddy_carve(a, 1, BUDDY_TOP, false);
+    return true;
+}
+
+/*
+ * buddy_release: give empty arena a back to the seg lists
+ */
+static void buddy_release(char *a)
+{
+    size_t i = buddy_find(a);
+    size_t count = GET(buddy_reg);
+    
+    buddy_carve(a, 1, BUDDY_TOP, true);
+    memmove(buddy_reg + (2 + i)*WSIZE, buddy_reg + (3 + i)*WSIZE, (count - i - 1) * WSIZE);
+    PUT(buddy_reg, count - 1);
+    blk_free(a);
+}
+
+/*
+ * buddy_alloc: a block of the smallest order that holds size bytes, split off a bigger free block if needed
+ */
+static void *buddy_alloc(size_t size)
+{
+    int k = size <= DSIZE ? 0 : 64 - __builtin_clzl(size - 1) - 4;
+    int j;
+    char *a, *b;
+    size_t n;
+    
+    for (j = k; j <= BUDDY_TOP && buddy_roots[j] == NULL; j++) {
+    }
+    if (j > BUDDY_TOP) {
+        if (!buddy_new()) {
+            return NULL;
+        }
+        for (j = k; buddy_roots[j] == NULL; j++) {
+        }
+    }
+    b = buddy_roots[j];
+    buddy_unlink(b, j);
+    a = (char *) ((size_t) b & ~(size_t) (BUDDY_ARENA - 1));
+    n = ((size_t) 1 << (BUDDY_TOP - j)) + ((size_t) (b - a) >> (4 + j));
+    buddy_put(BUDDY_FREE(a), n, 0);
+    while (j > k) {                       // keep the lower half, free the upper one
+        buddy_put(BUDDY_SPLIT(a), n, 1);
+        j--;
+        n = 2*n;
+        buddy_put(BUDDY_FREE(a), n + 1, 1);
+        buddy_push(b + ((size_t) DSIZE << j), j);
+    }
+    PUT(a + 2*BUDDY_MAP, BUDDY_USED(a) + ((size_t) DSIZE << k));
+    return b;
+}
+
+/*
+ * buddy_order: walk down the split blocks of arena a to the block that starts at ptr, set n to its index
+ */
+static int buddy_order(char *a, void *ptr, size_t *n)
+{
+    size_t off = (char *) ptr - a;
+    int k = BUDDY_TOP;
+    
+    *n = 1;
+    while (buddy_bit(BUDDY_SPLIT(a), *n)) {
+        k--;
+        *n = 2 * *n + ((off >> (4 + k)) & 1);
+    }
+    dbg_assert(buddy_addr(a, *n, k) == (char *) ptr);
+    return k;
+}
+
+/*
+ * buddy_free: free the block at ptr in arena a and merge it with its buddy for as long as that is free.
+ * An arena that is empty again goes back to the seg lists, unless it is the only one
+ */
+static void buddy_free(char *a, void *ptr)
+{
+    size_t n;
+    int k = buddy_order(a, ptr, &n);
+    
+    PUT(a + 2*BUDDY_MAP, BUDDY_USED(a) - ((size_t) DSIZE << k));
+    while (k < BUDDY_TOP && buddy_bit(BUDDY_FREE(a), n ^ 1)) {
+        buddy_unlink(buddy_addr(a, n ^ 1, k), k);
+        buddy_put(BUDDY_FREE(a), n ^ 1, 0);
+        n >>= 1;
+        k++;
+        buddy_put(BUDDY_SPLIT(a), n, 0);
+    }
+    buddy_put(BUDDY_FREE(a), n, 1);
+    buddy_push(buddy_addr(a, n, k), k);
+    if (BUDDY_USED(a) == 0 && GET(buddy_reg) > 1) {
+        buddy_release(a);
+    }
+}
+
+static void buddy_reset(void)
+{
+    buddy_reg = NULL;
+    for (int k = 0; k <= BUDDY_TOP; k++) {
+        buddy_roots[k] = NULL;
+    }
+}
+
+#endif /* BUDDY */
+
+#ifdef PAGERUN
+
+/*
+ * A run record is a 6-word allocated blk:
+ * word 0: first byte of the run, word 1: number of pages | 1 if the run is free,
+ * word 2/3: next/prev run in the free bin, word 4: payload of the span the run belongs to,
+ * word 5: offset of the payload in an allocated run (its color, always 0 without RUNCOLOR)
+ */
+#define RUNWORDS 6
+
+static int run_region = 0;                     // memlib region of the page map
+static char *run_radix = NULL;                 // root node of the page map
+static int run_height = 0;                     // levels of the page map, 0 while it is empty
+static size_t run_spanned = 0;                 // pages in the spans held by the runs
+static char *run_bins[RUN_MAXPAGES + 1];         // free runs by exact number of pages
+static uint64_t run_binmask = 0;               // bit n-1 is set if run_bins[n] is not empty
+#ifdef RUNCOLOR
+static size_t run_colors[RUN_MAXPAGES + 1];     // next color for runs of n pages
+#endif
+
+static char *RUN_START(char *r) { return GET_ADDRESS(r); }
+static size_t RUN_PAGES(char *r) { return GET(r + WSIZE) >> 1; }
+static size_t RUN_FREE(char *r) { return GET(r + WSIZE) & 1; }
+static char *RUN_NEXT(char *r) { return GET_ADDRESS(r + 2*WSIZE); }
+static char *RUN_PREV(char *r) { return GET_ADDRESS(r + 3*WSIZE); }
+static char *RUN_SPAN(char *r) { return GET_ADDRESS(r + 4*WSIZE); }
+static size_t RUN_OFFSET(char *r) { return GET(r + 5*WSIZE); }
+
+static void run_set(char *r, char *start, size_t pages, size_t free)
+{
+    PUT_ADDRESS(r, start);
+    PUT(r + WSIZE, (pages << 1) | free);
+}
+
+/*
+ * run_slot: address of the page map entry for the page holding addr; the missing nodes
+ * on the way are taken (zeroed) from the page map region when create is set, otherwise NULL is returned for them
+ */
+
+static char *run_slot(void *addr, bool create)
+{
+    size_t page = ((char *) addr - (char *) mem_heap_lo()) >> PAGESHIFT;
+    char **node = &run_radix, *fresh, *slot;
+    
+    while (run_height == 0 || (page >> (run_height * RADIX_BITS)) != 0) {    // the page is above what the tree covers: add a root
+        if (!create || (fresh = mem_region_sbrk(run_region, RADIX_NODE)) == (void *)-1) {
+            return NULL;
+        }
+        memset(fresh, 0, RADIX_NODE);
+        PUT_ADDRESS(fresh, run_radix);    // the old tree covers the lowest pages
+        run_radix = fresh;
+        run_height++;
+    }
+    for (int l = run_height - 1; ; l--) {
+        if (*node == NULL) {
+            if (!create || (fresh = mem_region_sbrk(run_region, RADIX_NODE)) == (void *)-1) {
+                return NULL;
+            }
+            memset(fresh, 0, RADIX_NODE);
+            *node = fresh;
+        }
+        slot = *node + ((page >> (l * RADIX_BITS)) & ((1 << RADIX_BITS) - 1)) * WSIZE;
+        if (l == 0) {
+            return slot;
+        }
+        node = (char **) slot;
+    }
+}
+
+static char *run_lookup(void *addr)
+{
+    char *slot = run_slot(addr, false);
+    return slot == NULL ? NULL : GET_ADDRESS(slot);
+}
+
+/*
+ * run_map: point the page map entries of the first and last page of run r to r (or to NULL if clear).
+ * Returns false if a node of the page map could not be allocated; the first entry may be set by then
+ */
+
+static bool run_map(char *r, bool clear)
+{
+    char *ends[2] = {RUN_START(r), RUN_START(r) + (RUN_PAGES(r) - 1) * PAGESIZE};
+    char *slot;
+    
+    for (int i = 0; i < 2; i++) {
+        if ((slot = run_slot(ends[i], !clear)) == NULL) {    // an entry without a node was never set, nothing to clear
+            if (!clear) {
+                return false;
+            }
+            continue;
+        }
+        PUT_ADDRESS(slot, clear ? NULL : r);
+    }
+    return true;
+}
+
+static void run_bin_add(char *r)
+{
+    size_t n = RUN_PAGES(r);
+    
+    PUT_ADDRESS(r + 2*WSIZE, run_bins[n]);
+    PUT_ADDRESS(r + 3*WSIZE, NULL);
+    if (run_bins[n] != NULL) {
+        PUT_ADDRESS(run_bins[n] + 3*WSIZE, r);
+    }
+    run_bins[n] = r;
+    run_binmask |= (uint64_t) 1 << (n - 1);
+}
+
+static void run_bin_remove(char *r)
+{
+    size_t n = RUN_PAGES(r);
+    
+    if (RUN_PREV(r) != NULL) {
+        PUT_ADDRESS(RUN_PREV(r) + 2*WSIZE, RUN_NEXT(r));
+    } else {
+        run_bins[n] = RUN_NEXT(r);
+    }
+    if (RUN_NEXT(r) != NULL) {
+        PUT_ADDRESS(RUN_NEXT(r) + 3*WSIZE, RUN_PREV(r));
+    }
+    if (run_bins[n] == NULL) {
+        run_binmask &= ~((uint64_t) 1 << (n - 1));
+    }
+}
+
+/*
+ * span_pages: number of pages in the span that starts at span
+ */
+
+static size_t span_pages(char *span)
+{
+    return (GET_SIZE(HDRP(span)) - WSIZE) >> PAGESHIFT;
+}
+
+/*
+ * run_new_span: take a page-aligned span of at least pages pages from the seg lists
+ * and return it as one free run
+ */
+
+static char *run_new_span(size_t pages)
+{
+    size_t grown = run_spanned / 2 < SPAN_MAXPAGES ? run_spanned / 2 : SPAN_MAXPAGES;   // geometric growth of the spans
+    char *span, *r;
+    
+    if (pages < grown) {
+        pages = grown;
+    }
+    if ((span = blk_alloc_aligned(PAGESIZE, pages * PAGESIZE)) == NULL) {
+        return NULL;
+    }
+    if ((r = blk_alloc(blk_adjust(RUNWORDS * WSIZE))) == NULL) {
+        blk_free(span);
+        return NULL;
+    }
+    run_set(r, span, pages, 1);
+    PUT_ADDRESS(r + 4*WSIZE, span);
+    if (!run_map(r, false)) {
+        run_map(r, true);
+        blk_free(r);
+        blk_free(span);
+        return NULL;
+    }
+    run_spanned += pages;
+    return r;
+}
+
+/*
+ * run_color: payload offset for the next run of pages pages holding size bytes
+ */
+
+static size_t run_color(size_t pages, size_t size)
+{
+#ifdef RUNCOLOR
+    size_t colors = (pages * PAGESIZE - size) / COLOR + 1;   // offsets that still leave room for size bytes
+    
+    if (colors > RUN_COLORS) {
+        colors = RUN_COLORS;
+    }
+    return (run_colors[pages]++ % colors) * COLOR;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * run_alloc: allocate a run of at least size bytes, first fit over the bins by number of pages
+ */
+
+static void *run_alloc(size_t size)
+{
+    size_t pages = (size + PAGESIZE - 1) >> PAGESHIFT;
+    uint64_t fit = run_binmask & (~(uint64_t) 0 << (pages - 1));
+    char *r, *rest;
+    
+    if (fit != 0) {
+        r = run_bins[__builtin_ctzll(fit) + 1];
+        run_bin_remove(r);
+    } else if ((r = run_new_span(pages)) == NULL) {
+        return NULL;
+    }
+    
+    if (RUN_PAGES(r) > pages) {                  // split, the pages after ours stay free
+        if ((rest = blk_alloc(blk_adjust(RUNWORDS * WSIZE))) == NULL) {
+            run_bin_add(r);
+            return NULL;
+        }
+        run_map(r, true);
+        run_set(rest, RUN_START(r) + pages * PAGESIZE, RUN_PAGES(r) - pages, 1);
+        PUT_ADDRESS(rest + 4*WSIZE, RUN_SPAN(r));
+        run_set(r, RUN_START(r), pages, 0);
+        if (!run_map(r, false) || !run_map(rest, false)) {     // no room for the page map: put r back whole
+            run_map(r, true);
+            run_map(rest, true);
+            run_set(r, RUN_START(r), pages + RUN_PAGES(rest), 1);
+            run_map(r, false);                                  // its old entries, their nodes are still there
+            blk_free(rest);
+            run_bin_add(r);
+            return NULL;
+        }
+        run_bin_add(rest);
+    } else {
+        run_set(r, RUN_START(r), pages, 0);
+    }
+    PUT(r + 5*WSIZE, run_color(pages, size));
+    return RUN_START(r) + RUN_OFFSET(r);
+}
+
+/*
+ * run_merge: absorb free run b, which starts right after run a, into a; b's record is freed
+ */
+
+static void run_merge(char *a, char *b)
+{
+    run_map(a, true);
+    run_map(b, true);
+    run_set(a, RUN_START(a), RUN_PAGES(a) + RUN_PAGES(b), 1);
+    blk_free(b);
+    run_map(a, false);
+}
+
+/*
+ * run_free: free run r, coalesce it with the free runs right before and after it in the same span,
+ * and give the span back to the seg lists once it is completely free
+ */
+
+static void run_free(char *r)
+{
+    char *start = RUN_START(r);
+    char *span = RUN_SPAN(r);
+    char *left = start == span ? NULL : run_lookup(start - PAGESIZE);
+    char *end = start + RUN_PAGES(r) * PAGESIZE;
+    char *right = end == span + span_pages(span) * PAGESIZE ? NULL : run_lookup(end);
+    
+    run_set(r, start, RUN_PAGES(r), 1);
+    if (left != NULL && RUN_FREE(left)) {
+        run_bin_remove(left);
+        run_merge(left, r);
+        r = left;
+    }
+    if (right != NULL && RUN_FREE(right)) {
+        run_bin_remove(right);
+        run_merge(r, right);
+    }
+    
+    if (RUN_PAGES(r) == span_pages(span)) {
+        run_spanned -= RUN_PAGES(r);
+        run_map(r, true);
+        blk_free(r);
+        blk_free(span);
+    } else {
+        run_bin_add(r);
+    }
+}
+
+/*
+ * run_of: the allocated run whose payload is ptr, NULL if ptr is an ordinary blk
+ * the payload is in the first page of its run, and no ordinary blk shares a page with a span
+ */
+
+static char *run_of(void *ptr)
+{
+    char *r;
+    
+    if (run_radix == NULL) {
+        return NULL;
+    }
+#ifndef RUNCOLOR
+    if (((size_t) ptr & (PAGESIZE - 1)) != 0) {   // uncolored runs start on a page
+        return NULL;
+    }
+#endif
+    r = run_lookup(ptr);
+    if (r == NULL || RUN_START(r) + RUN_OFFSET(r) != (char *) ptr || RUN_FREE(r)) {
+        return NULL;
+    }
+    return r;
+}
+
+/*
+ * run_reset: forget every run and empty the page map region
+ */
+
+static void run_reset(void)
+{
+    mem_region_rewind(run_region, 0);
+    run_radix = NULL;
+    run_height = 0;
+    run_spanned = 0;
+    run_binmask = 0;
+    for (int i = 0; i <= RUN_MAXPAGES; i++) {
+        run_bins[i] = NULL;
+#ifdef RUNCOLOR
+        run_colors[i] = 0;
+#endif
+    }
+}
+
+/*
+ * run_init: create the page map region
+ */
+
+static bool run_init(void)
+{
+    if ((run_region = mem_region_create(RUN_REGION)) < 0) {
+        return false;
+    }
+    run_reset();
+    return true;
+}
+
+#endif /* PAGERUN */
+
+#ifdef OOBMETA
+
+/*
+ * Segment header words: 0 flags, 1 granules in use (normal) or payload bytes (large),
+ * 2 upper bound of the largest free blk in granules (normal), 3 bytes from the segment start to brk
+ * or to the next segment. The start bitmap follows at word 4, the alloc bitmap right after it.
+ */
+
+static char *oob_last = NULL;      // segment with the highest address
+static size_t oob_bound = 0;       // upper bound of the largest free blk (granules) over all normal segments
+
+static size_t SEG_FLAGS(char *seg) { return GET(seg); }
+static size_t SEG_USED(char *seg) { return GET(seg + WSIZE); }
+static size_t SEG_HINT(char *seg) { return GET(seg + 2*WSIZE); }
+static size_t SEG_SPAN(char *seg) { return GET(seg + 3*WSIZE); }
+
+static char *SEG_MAP(char *seg, int map)    // map 0: start bits, map 1: alloc bits
+{
+    return seg + 4*WSIZE + map*SEG_MAPWORDS*WSIZE;
+}
+
+static char *seg_of(void *ptr)
+{
+    char *lo = mem_heap_lo();
+    return lo + (((char *) ptr - lo) & ~(size_t) (SEG_SIZE - 1));
+}
+
+static char *seg_next(char *seg)
+{
+    return seg + ((SEG_SPAN(seg) + SEG_SIZE - 1) & ~(size_t) (SEG_SIZE - 1));
+}
+
+static size_t bit_get(char *seg, int map, size_t i)
+{
+    return (GET(SEG_MAP(seg, map) + (i / 64)*WSIZE) >> (i % 64)) & 1;
+}
+
+static void bit_put(char *seg, int map, size_t i, size_t val)
+{
+    char *w = SEG_MAP(seg, map) + (i / 64)*WSIZE;
+    size_t mask = (size_t) 1 << (i % 64);
+    PUT(w, val ? GET(w) | mask : GET(w) & ~mask);
+}
+
+/*
+ * next_start: first start bit after granule i, or the end of the used part of the segment
+ */
+
+static size_t next_start(char *seg, size_t i)
+{
+    size_t used = SEG_USED(seg);
+    size_t w = (i + 1) / 64;
+    size_t bits;
+    
+    if (i + 1 >= used) {
+        return used;
+    }
+    bits = GET(SEG_MAP(seg, 0) + w*WSIZE) & (~(size_t) 0 << ((i + 1) % 64));
+    while (bits == 0) {
+        if (++w * 64 >= used) {
+            return used;
+        }
+        bits = GET(SEG_MAP(seg, 0) + w*WSIZE);
+    }
+    i = w * 64 + __builtin_ctzl(bits);
+    return i < used ? i : used;
+}
+
+/*
+ * prev_start: last start bit before granule i (i > 0, granule 0 always starts a blk)
+ */
+
+static size_t prev_start(char *seg, size_t i)
+{
+    size_t w = (i - 1) / 64;
+    size_t bits = GET(SEG_MAP(seg, 0) + w*WSIZE);
+    
+    if ((i - 1) % 64 != 63) {
+        bits &= ((size_t) 1 << ((i - 1) % 64 + 1)) - 1;
+    }
+    while (bits == 0) {
+        bits = GET(SEG_MAP(seg, 0) + (--w)*WSIZE);
+    }
+    return w * 64 + 63 - __builtin_clzl(bits);
+}
+
+static char *GRANULE(char *seg, size_t i)
+{
+    return seg + SEG_DATA + i*DSIZE;
+}
+
+/*
+ * seg_take: allocate g granules at free blk i of length len and free the rest
+ */
+
+static void *seg_take(char *seg, size_t i, size_t len, size_t g)
+{
+    bit_put(seg, 1, i, 1);
+    if (len > g) {
+        bit_put(seg, 0, i + g, 1);
+    }
+    return GRANULE(seg, i);
+}
+
+/*
+ * seg_search: first fit over the free blks of a normal segment. A failed search leaves the exact size
+ * of the largest free blk in the segment's hint
+ */
+
+static void *seg_search(char *seg, size_t g)
+{
+    size_t used = SEG_USED(seg), best = 0;
+    size_t i, len, bits;
+    
+    for (size_t w = 0; w * 64 < used; w++) {
+        bits = GET(SEG_MAP(seg, 0) + w*WSIZE) & ~GET(SEG_MAP(seg, 1) + w*WSIZE);   // free blk starts
+        while (bits != 0) {
+            i = w * 64 + __builtin_ctzl(bits);
+            bits &= bits - 1;
+            if (i >= used) {
+                break;
+            }
+            len = next_start(seg, i) - i;
+            if (len >= g) {
+                return seg_take(seg, i, len, g);
+            }
+            best = len > best ? len : best;
+        }
+    }
+    PUT(seg + 2*WSIZE, best);
+    return NULL;
+}
+
+/*
+ * seg_grow: back n more granules of the last segment with heap, as one free blk merged with a free tail
+ */
+
+static bool seg_grow(char *seg, size_t n)
+{
+    size_t used = SEG_USED(seg);
+    
+    if (mem_sbrk(n * DSIZE) == (void *)-1) {
+        return false;
+    }
+    if (used == 0 || bit_get(seg, 1, prev_start(seg, used))) {
+        bit_put(seg, 0, used, 1);                 // the new granules start a free blk of their own
+    }
+    PUT(seg + WSIZE, used + n);
+    PUT(seg + 3*WSIZE, SEG_DATA + (used + n)*DSIZE);
+    return true;
+}
+
+/*
+ * seg_tail: length of the free blk at the end of a normal segment, 0 if the last blk is allocated
+ */
+
+static size_t seg_tail(char *seg)
+{
+    size_t used = SEG_USED(seg), last;
+    
+    if (used == 0) {
+        return 0;
+    }
+    last = prev_start(seg, used);
+    return bit_get(seg, 1, last) ? 0 : used - last;
+}
+
+/*
+ * seg_new: start a segment at the next window boundary
+ */
+
+static char *seg_new(size_t flags, size_t header)
+{
+    size_t pad = (SEG_SIZE - (mem_heapsize() & (SEG_SIZE - 1))) & (SEG_SIZE - 1);
+    char *seg;
+    
+    if (oob_last != NULL && !(SEG_FLAGS(oob_last) & SEG_LARGE) && pad != 0) {
+        size_t tail = seg_tail(oob_last);
+        if (!seg_grow(oob_last, pad / DSIZE)) {     // the rest of the window stays usable by the old segment
+            return NULL;
+        }
+        tail += pad / DSIZE;
+        PUT(oob_last + 2*WSIZE, SEG_HINT(oob_last) > tail ? SEG_HINT(oob_last) : tail);
+        oob_bound = oob_bound > tail ? oob_bound : tail;
+    } else if (pad != 0 && mem_sbrk(pad) == (void *)-1) {
+        return NULL;
+    }
+    if ((seg = mem_sbrk(header)) == (void *)-1) {
+        return NULL;
+    }
+    memset(seg, 0, header);
+    PUT(seg, flags);
+    PUT(seg + 3*WSIZE, header);
+    oob_last = seg;
+    return seg;
+}
+
+static void *oob_alloc_large(size_t size)
+{
+    size_t bytes = align(size);
+    char *seg;
+    
+    for (seg = mem_heap_lo(); oob_last != NULL && seg <= oob_last; seg = seg_next(seg)) {
+        if (SEG_FLAGS(seg) == (SEG_LARGE | SEG_FREE) && SEG_USED(seg) >= bytes) {
+            PUT(seg, SEG_LARGE);
+            return seg + 4*WSIZE;
+        }
+    }
+    if ((seg = seg_new(SEG_LARGE, 4*WSIZE)) == NULL || mem_sbrk(bytes) == (void *)-1) {
+        return NULL;
+    }
+    PUT(seg + WSIZE, bytes);
+    PUT(seg + 3*WSIZE, 4*WSIZE + bytes);
+    return seg + 4*WSIZE;
+}
+
+static void *oob_alloc(size_t size)
+{
+    size_t g = (size + DSIZE - 1) / DSIZE;
+    size_t bound = 0, tail;
+    char *seg;
+    void *bp;
+    
+    if (g > SEG_GRANULES) {
+        return oob_alloc_large(size);
+    }
+    
+    if (g <= oob_bound) {                        // some segment may have a free blk that fits
+        for (seg = mem_heap_lo(); seg <= oob_last; seg = seg_next(seg)) {
+            if (SEG_FLAGS(seg) & SEG_LARGE) {
+                continue;
+            }
+            if (SEG_HINT(seg) >= g && (bp = seg_search(seg, g)) != NULL) {
+                return bp;
+            }
+            bound = SEG_HINT(seg) > bound ? SEG_HINT(seg) : bound;
+        }
+        oob_bound = bound;                       // every hint is exact or too small now
+    }
+    
+    seg = oob_last;
+    if (seg == NULL || (SEG_FLAGS(seg) & SEG_LARGE) || SEG_USED(seg) - seg_tail(seg) + g > SEG_GRANULES) {
+        if ((seg = seg_new(0, SEG_DATA)) == NULL) {
+            return NULL;
+        }
+    }
+    tail = seg_tail(seg);                         // grow the last segment by what its free tail is missing
+    if (!seg_grow(seg, g - tail)) {
+        return NULL;
+    }
+    return seg_take(seg, SEG_USED(seg) - g, g, g);
+}
+
+static void oob_free(void *ptr)
+{
+    char *seg = seg_of(ptr);
+    size_t i, next, len;
+    
+    if (SEG_FLAGS(seg) & SEG_LARGE) {
+        PUT(seg, SEG_LARGE | SEG_FREE);
+        return;
+    }
+    i = ((char *) ptr - seg - SEG_DATA) / DSIZE;
+    bit_put(seg, 1, i, 0);
+    next = next_start(seg, i);
+    if (next < SEG_USED(seg) && !bit_get(seg, 1, next)) {    // coalesce with the next blk
+        bit_put(seg, 0, next, 0);
+    }
+    if (i > 0) {
+        size_t prev = prev_start(seg, i);
+        if (!bit_get(seg, 1, prev)) {                         // coalesce with the previous blk
+            bit_put(seg, 0, i, 0);
+            i = prev;
+        }
+    }
+    len = next_start(seg, i) - i;
+    if (len > SEG_HINT(seg)) {
+        PUT(seg + 2*WSIZE, len);
+    }
+    oob_bound = oob_bound > len ? oob_bound : len;
+}
+
+static size_t oob_usable(void *ptr)
+{
+    char *seg = seg_of(ptr);
+    size_t i;
+    
+    if (SEG_FLAGS(seg) & SEG_LARGE) {
+        return SEG_USED(seg);
+    }
+    i = ((char *) ptr - seg - SEG_DATA) / DSIZE;
+    return (next_start(seg, i) - i) * DSIZE;
+}
+
+static bool oob_init(void)
+{
+    oob_last = NULL;
+    oob_bound = 0;
+    return true;
+}
+
+/*
+ * oob_check: every alloc bit sits on a start bit and no two free blks are next to each other
+ */
+
+static bool oob_check(int lineno)
+{
+    char *seg;
+    
+    for (seg = mem_heap_lo(); oob_last != NULL && seg <= oob_last; seg = seg_next(seg)) {
+        if (SEG_FLAGS(seg) & SEG_LARGE) {
+            continue;
+        }
+        bool prev_free = false;
+        for (size_t i = 0; i < SEG_USED(seg); i = next_start(seg, i)) {
+            if (!bit_get(seg, 0, i)) {
+                dbg_printf("Granule %zu of segment %p is not a blk start at line %d\n", i, seg, lineno);
+                return false;
+            }
+            if (!bit_get(seg, 1, i) && prev_free) {
+                dbg_printf("Free blk at granule %zu of segment %p escaped from coalescing at line %d\n", i, seg, lineno);
+                return false;
+            }
+            prev_free = !bit_get(seg, 1, i);
+        }
+        for (size_t w = 0; w < SEG_MAPWORDS; w++) {
+            if (GET(SEG_MAP(seg, 1) + w*WSIZE) & ~GET(SEG_MAP(seg, 0) + w*WSIZE)) {
+                dbg_printf("Alloc bit without start bit in segment %p at line %d\n", seg, lineno);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+#endif /* OOBMETA */
+
+#ifdef MM_THREADS
+
+/*
+ * Thread-safe build: one lock around the seg lists, lock-free stacks for the small classes.
+ */
+
+static pthread_mutex_t mt_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t mt_stacks[MT_CLASSES];       // tag << TAG_SHIFT | address of the top blk
+
+static uint64_t *mt_stack(size_t asize)      // stack for blks of exactly asize bytes
+{
+    return &mt_stacks[asize / DSIZE - 2];
+}
+
+static char *TAG_PTR(uint64_t head)
+{
+    return (char *) (uintptr_t) (head & (((uint64_t) 1 << TAG_SHIFT) - 1));
+}
+
+static uint64_t TAG_NEXT(uint64_t head, void *bp)    // new head pointing at bp, with the next generation tag
+{
+    return (((head >> TAG_SHIFT) + 1) << TAG_SHIFT) | (uint64_t) (uintptr_t) bp;
+}
+
+/*
+ * mt_push: push blk bp on the stack for its size, bp stays marked allocated in the heap
+ */
+
+static void mt_push(uint64_t *stack, char *bp)
+{
+    uint64_t head = __atomic_load_n(stack, __ATOMIC_RELAXED);
+    
+    do {
+        PUT_ADDRESS(bp, TAG_PTR(head));      // the first payload word links to the blk below
+    } while (!__atomic_compare_exchange_n(stack, &head, TAG_NEXT(head, bp), true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * mt_pop: pop a blk from the stack, or NULL if it is empty
+ * the link is read from a blk another thread may have popped and written to meanwhile,
+ * that value is never used because the tag has moved on and the compare-and-swap fails
+ */
+
+static char *mt_pop(uint64_t *stack)
+{
+    uint64_t head = __atomic_load_n(stack, __ATOMIC_ACQUIRE);
+    char *bp, *next;
+    
+    do {
+        if ((bp = TAG_PTR(head)) == NULL) {
+            return NULL;
+        }
+        next = (char *) __atomic_load_n((size_t *) bp, __ATOMIC_RELAXED);
+    } while (!__atomic_compare_exchange_n(stack, &head, TAG_NEXT(head, next), true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+    return bp;
+}
+
+/*
+ * mt_reset: empty the stacks, heap addresses must leave the tag bits free
+ */
+
+static bool mt_reset(void)
+{
+    for (int i = 0; i < MT_CLASSES; i++) {
+        mt_stacks[i] = 0;
+    }
+    return ((uintptr_t) mem_heap_lo() >> TAG_SHIFT) == 0;
+}
+
+static void *mt_alloc(size_t size)
+{
+    size_t asize = blk_adjust(size);
+    char *bp;
+    
+    if (asize <= MT_SMALL && (bp = mt_pop(mt_stack(asize))) != NULL) {
+        return bp;
+    }
+    pthread_mutex_lock(&mt_lock);
+    bp = blk_alloc(asize);
+    pthread_mutex_unlock(&mt_lock);
+    return bp;
+}
+
+static void mt_free(void *ptr)
+{
+    size_t size = GET_SIZE(HDRP(ptr));       // other threads only flip the prev-alloc bit of an allocated blk
+    
+    if (size <= MT_SMALL) {
+        mt_push(mt_stack(size), ptr);
+        return;
+    }
+    pthread_mutex_lock(&mt_lock);
+    blk_free(ptr);
+    pthread_mutex_unlock(&mt_lock);
+}
+
+#endif /* MM_THREADS */
+
+/*
+ * usable_size: number of payload bytes the allocation at ptr can hold
+ */
+
+static size_t usable_size(void *ptr)
+{
+#ifdef OOBMETA
+    return oob_usable(ptr);
+#else
+#ifdef PAGERUN
+    char *r = run_of(ptr);
+    if (r != NULL) {
+        return RUN_PAGES(r) * PAGESIZE - RUN_OFFSET(r);
+    }
+#endif
+#ifdef BUDDY
+    char *a = buddy_of(ptr);
+    if (a != NULL) {
+        size_t n;
+        return (size_t) DSIZE << buddy_order(a, ptr, &n);
+    }
+#endif
+    return GET_SIZE(HDRP(ptr)) - WSIZE;
+#endif
+}
+
+#ifndef OOBMETA
+
+/*
+ * blk_serves: whether malloc takes a blk of size bytes from the seg lists
+ */
+static bool blk_serves(size_t size)
+{
+#ifdef LINE_MIN
+    if (size >= LINE_MIN && size <= LINE_MAX) {
+        return false;
+    }
+#endif
+#ifdef PAGERUN
+    if (size >= RUN_MIN && size <= RUN_MAX) {
+        return false;
+    }
+#endif
+#ifdef BUDDY
+    if (size >= BUDDY_MIN && size <= BUDDY_MAX) {
+        return false;
+    }
+#endif
+    return true;
+}
+
+/*
+ * blk_owns: whether ptr is the payload of a seg list blk
+ */
+static bool blk_owns(void *ptr)
+{
+#ifdef PAGERUN
+    if (run_of(ptr) != NULL) {
+        return false;
+    }
+#endif
+#ifdef BUDDY
+    if (buddy_of(ptr) != NULL) {
+        return false;
+    }
+#endif
+    return true;
+}
+
+#endif /* !OOBMETA */
+
+#ifndef DRIVER
+
+/*
+ * Library build (libmm.so): nobody calls mem_init and mm_init, the first malloc does,
+ * on the memory memsys.c gets from the OS
+ */
+
+static pthread_once_t lib_once = PTHREAD_ONCE_INIT;
+static bool lib_ready = false;
+
+#ifdef MM_THREADS
+static void lib_lock(void) { pthread_mutex_lock(&mt_lock); }
+static void lib_unlock(void) { pthread_mutex_unlock(&mt_lock); }
+#endif
+
+static void lib_init(void)
+{
+    mem_init();
+    if (mem_heap_lo() != NULL && mm_init()) {    // memsys.c could not reserve the heap if it has no start
+#ifdef MM_THREADS
+        pthread_atfork(lib_lock, lib_unlock, lib_unlock);    // a child forked while another thread held the lock could never take it
+#endif
+        __atomic_store_n(&lib_ready, true, __ATOMIC_RELEASE);
+    }
+}
+
+/*
+ * lib_start: whether the heap is ready, setting it up on the first call
+ */
+static bool lib_start(void)
+{
+    if (!__atomic_load_n(&lib_ready, __ATOMIC_ACQUIRE)) {
+        pthread_once(&lib_once, lib_init);
+        if (!__atomic_load_n(&lib_ready, __ATOMIC_ACQUIRE)) {
+            errno = ENOMEM;
+            return false;
+        }
+    }
+    return true;
+}
+
+#else
+
+static bool lib_start(void)    // the driver calls mem_init and mm_init itself
+{
+    return true;
+}
+
+#endif /* !DRIVER */
+
+/*
+ * malloc
+ */
+void* malloc(size_t size)
+{
+#ifndef DRIVER
+    if (!lib_start()) {
+        return NULL;
+    }
+    if (size == 0) {
+        size = 1;                  // programs take NULL for out of memory, give them a blk of their own
+    }
+#endif
+    if (size <= 0){
+	      return NULL;
+    }
+#ifdef LINE_MIN
+    if (size >= LINE_MIN && size <= LINE_MAX) {
+        return malloc_cacheline(size);
+    }
+#endif
+#if defined(MM_THREADS)
+    return mt_alloc(size);
+#elif defined(OOBMETA)
+    return oob_alloc(size);
+#else
+#ifdef PAGERUN
+    if (size >= RUN_MIN && size <= RUN_MAX) {
+        return run_alloc(size);
     }
+#endif
+#ifdef BUDDY
+    if (size >= BUDDY_MIN && size <= BUDDY_MAX) {
+        return buddy_alloc(size);
+    }
+#endif
     
- 
-    if ((bp = extend_heap(asize)) == NULL){ // if no fit free blk, extend the heap
+    return blk_alloc(blk_adjust(size)); // adjust the size to make it no less than 32 B
+#endif
+}
+
+
+/*
+ * mm_malloc_hint: malloc, telling the allocator how long the blk is going to live.
+ * With LIFETIME a short-lived blk comes from the short-lived region, otherwise the hint is ignored
+ */
+void *mm_malloc_hint(size_t size, int lifetime)
+{
+#ifdef LIFETIME
+    void *bp;
+    
+    if (!lib_start()) {
         return NULL;
     }
-    place(bp, asize);	
-
-        
+#ifdef PAGERUN
+    if (size >= RUN_MIN && size <= RUN_MAX) {
+        lifetime = MM_LIVE_LONG;      // the page map only covers the heap, so page runs stay in it
+    }
+#endif
+    life_class = lifetime == MM_LIVE_SHORT ? LIFE_BIT : 0;
+    bp = malloc(size);
+    life_class = 0;
     return bp;
+#else
+    return malloc(size);
+#endif
+}
+
+/*
+ * memalign: allocate size bytes at a multiple of alignment, which must be a power of two
+ * aligned blks come from the seg lists even in the PAGERUN build, so free needs no special case
+ */
+void *memalign(size_t alignment, size_t size)
+{
+    void *bp;
     
+    if (size == 0 || alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        return NULL;
+    }
+#ifndef DRIVER
+    if (!lib_start()) {
+        return NULL;
+    }
+#endif
+#if defined(MM_THREADS)
+    pthread_mutex_lock(&mt_lock);
+    bp = blk_alloc_aligned(alignment, size);
+    pthread_mutex_unlock(&mt_lock);
+#elif defined(OOBMETA)
+    bp = alignment <= ALIGNMENT ? oob_alloc(size) : NULL;   // granules are only 16-byte aligned
+#else
+    bp = blk_alloc_aligned(alignment, size);
+#endif
+    return bp;
 }
 
+/*
+ * malloc_cacheline: allocate size bytes padded to whole cache lines that no other blk's payload touches,
+ * so two blks written by different threads never share a line
+ */
+void *malloc_cacheline(size_t size)
+{
+    if (size == 0) {
+        return NULL;
+    }
+    return memalign(CACHELINE, (size + CACHELINE - 1) & ~(size_t) (CACHELINE - 1));
+}
 
 /*
  * free
  */
 void free(void* ptr)
 {  
-    size_t size;
-    char *next = NEXT_BLK(ptr);
-    
     if (ptr == NULL){
          return;
     }
-    size = GET_SIZE(HDRP(ptr));
-    PUT(HDRP(ptr), size | PREV_ALLOC(HDRP(ptr))); // set the ptr blk not allocated  for header, footer and next blk's header and footer
-    PUT(FTRP(ptr), GET(HDRP(ptr)));
-    PUT(HDRP(next), GET_SIZE(HDRP(next)) | GET_ALLOC(HDRP(next)));
-    
-    addtoSeg(ptr, size);     // add freed blk to seg list
-    coalesce(ptr);          //try to coalesce
-    
-     
-    
+#if defined(MM_THREADS)
+    mt_free(ptr);
+#elif defined(OOBMETA)
+    oob_free(ptr);
+#else
+#ifdef PAGERUN
+    char *r = run_of(ptr);
+    if (r != NULL) {
+        run_free(r);
+        return;
+    }
+#endif
+#ifdef BUDDY
+    char *a = buddy_of(ptr);
+    if (a != NULL) {
+        buddy_free(a, ptr);
+        return;
+    }
+#endif
+    blk_free(ptr);
+#endif
 }
 
 
@@ -470,13 +2731,37 @@ void free(void* ptr)
 void* realloc(void* oldptr, size_t size)
 {
   char *newadd;
+  size_t oldsize;
+  int kind;
     
     if ( oldptr == NULL ){    // if ptr is NULL, do malloc
          return malloc(size);
     }
+    if ( size == 0 ){         // if size is 0, do free
+         free(oldptr);
+         return NULL;
+    }
+#ifndef OOBMETA
+    if (blk_serves(size) && blk_owns(oldptr)) {   // a seg list blk that stays one: resize it in place if possible
+#ifdef MM_THREADS
+        pthread_mutex_lock(&mt_lock);
+#endif
+        newadd = blk_realloc(oldptr, size);
+#ifdef MM_THREADS
+        pthread_mutex_unlock(&mt_lock);
+#endif
+        return newadd;
+    }
+#endif
     newadd = malloc(size);  //malloc for a new blk
+    if (newadd == NULL) {
+         return NULL;
+    }
     
-    mem_memcpy(newadd, oldptr, size); //copy content to new blk
+    oldsize = usable_size(oldptr);
+    kind = traffic_kind(MEM_KIND_REALLOC);
+    mem_memcpy(newadd, oldptr, size < oldsize ? size : oldsize); //copy content to new blk
+    traffic_kind(kind);
 
     free(oldptr);  //free the old blk
 
@@ -491,21 +2776,450 @@ void* realloc(void* oldptr, size_t size)
 void* calloc(size_t nmemb, size_t size)
 {
     void* ptr;
+    int kind;
+    if (nmemb != 0 && size > SIZE_MAX / nmemb) {
+#ifndef DRIVER
+        errno = ENOMEM;
+#endif
+        return NULL;
+    }
     size *= nmemb;
     ptr = malloc(size);
     if (ptr) {
+        kind = traffic_kind(MEM_KIND_CALLOC);
         memset(ptr, 0, size);
+        traffic_kind(kind);
     }
     return ptr;
 }
 
+#ifndef DRIVER
+
+/*
+ * The rest of the libc allocation interface, so that no blk of ours ever reaches the libc malloc or the reverse
+ */
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *ptr;
+    
+    if (alignment == 0 || alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    if ((ptr = memalign(alignment, size != 0 ? size : 1)) == NULL) {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size != 0 ? size : 1);
+}
+
+void *valloc(size_t size)
+{
+    return memalign(getpagesize(), size != 0 ? size : 1);
+}
+
+void *pvalloc(size_t size)
+{
+    size_t page = getpagesize();
+    
+    return memalign(page, size != 0 ? (size + page - 1) & ~(page - 1) : page);
+}
+
+void *reallocarray(void *ptr, size_t nmemb, size_t size)
+{
+    if (nmemb != 0 && size > SIZE_MAX / nmemb) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(ptr, nmemb * size);
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+    return ptr != NULL ? usable_size(ptr) : 0;
+}
+
+#endif /* !DRIVER */
+
+/*
+ * mm_reserve: make sure the heap ends with one free blk of at least bytes bytes,
+ * so the next bytes of requests are served without growing the heap
+ */
+bool mm_reserve(size_t bytes)
+{
+    if (!lib_start()) {
+        return false;
+    }
+#ifdef OOBMETA
+    return true;                           // segments are created one window at a time
+#else
+    char *epilogue;
+    size_t have;
+    size_t need = align(bytes) + DSIZE;    // header and footer of the free blk
+    bool ok = true;
+    
+#ifdef MM_THREADS
+    pthread_mutex_lock(&mt_lock);          // the end of the heap moves under every extend_heap
+#endif
+    epilogue = (char *) mem_heap_hi() + 1 - WSIZE;
+    have = PREV_ALLOC(epilogue) ? 0 : GET_SIZE(epilogue - WSIZE);
+    if (have < need) {
+        need -= have;
+        if (need < 2*DSIZE) {
+            need = 2*DSIZE;
+        }
+        ok = extend_heap(need) != NULL;
+    }
+#ifdef MM_THREADS
+    pthread_mutex_unlock(&mt_lock);
+#endif
+    return ok;
+#endif
+}
+
+/*
+ * mm_hint_peak: tell the allocator the heap is expected to reach bytes bytes,
+ * it then grows in steps of bytes / GROW_STEPS until it gets there. mm_init forgets the hint
+ */
+void mm_hint_peak(size_t bytes)
+{
+    if (!lib_start()) {
+        return;
+    }
+#ifndef OOBMETA
+    grow_peak = align(bytes);
+    grow_step = align(bytes / GROW_STEPS);
+    if (grow_step < CHUNKSIZE) {
+        grow_step = CHUNKSIZE;
+    }
+#endif
+}
+
+/*
+ * Arenas: bump allocation in chunks taken from malloc, given back all at once.
+ * The handle is a 4-word blk: bump pointer, end of the current chunk, chunk list and size of the next chunk.
+ * Every chunk starts with a link to the chunk before it, padded to DSIZE; the current chunk heads the list
+ */
+static char *ARENA_CUR(char *a) { return GET_ADDRESS(a); }
+static char *ARENA_END(char *a) { return GET_ADDRESS(a + WSIZE); }
+static char *ARENA_CHUNKS(char *a) { return GET_ADDRESS(a + 2*WSIZE); }
+static size_t ARENA_NEXT(char *a) { return GET(a + 3*WSIZE); }
+static char *CHUNK_LINK(char *c) { return GET_ADDRESS(c); }
+
+/*
+ * arena_chunk: malloc a chunk for at least size bytes. A request bigger than a quarter of the next chunk
+ * gets a chunk of its own, linked behind the current one so that bumping goes on where it was
+ */
+static void *arena_chunk(char *a, size_t size)
+{
+    size_t next = ARENA_NEXT(a);
+    char *head = ARENA_CHUNKS(a);
+    char *c;
+    
+    if (head != NULL && size > next / 4) {
+        if ((c = malloc(size + DSIZE)) == NULL) {
+            return NULL;
+        }
+        PUT_ADDRESS(c, CHUNK_LINK(head));
+        PUT_ADDRESS(head, c);
+        return c + DSIZE;
+    }
+    if (next < size + DSIZE) {
+        next = size + DSIZE;
+    }
+    if ((c = malloc(next)) == NULL) {
+        return NULL;
+    }
+    PUT_ADDRESS(c, head);
+    PUT_ADDRESS(a, c + DSIZE + size);
+    PUT_ADDRESS(a + WSIZE, c + next);
+    PUT_ADDRESS(a + 2*WSIZE, c);
+    PUT(a + 3*WSIZE, 2 * next < ARENA_MAX ? 2 * next : ARENA_MAX);
+    return c + DSIZE;
+}
+
+/*
+ * arena_release: free every chunk in the list from c on
+ */
+static void arena_release(char *c)
+{
+    char *link;
+    
+    while (c != NULL) {
+        link = CHUNK_LINK(c);
+        free(c);
+        c = link;
+    }
+}
+
+/*
+ * mm_arena_create: an empty arena, its first chunk is taken on the first mm_arena_malloc
+ */
+struct mm_arena *mm_arena_create(void)
+{
+    char *a;
+    
+    if (!lib_start()) {
+        return NULL;
+    }
+    if ((a = malloc(4*WSIZE)) != NULL) {
+        PUT_ADDRESS(a, NULL);
+        PUT_ADDRESS(a + WSIZE, NULL);
+        PUT_ADDRESS(a + 2*WSIZE, NULL);
+        PUT(a + 3*WSIZE, ARENA_FIRST);
+    }
+    return (struct mm_arena *) a;
+}
+
+/*
+ * mm_arena_malloc: size bytes from the arena, 16-byte aligned. There is no free for one object
+ */
+void *mm_arena_malloc(struct mm_arena *arena, size_t size)
+{
+    char *a = (char *) arena;
+    char *bp;
+    
+    if (!lib_start() || size == 0) {
+        return NULL;
+    }
+    bp = ARENA_CUR(a);
+    size = align(size);
+    if (size <= (size_t) (ARENA_END(a) - bp)) {
+        PUT_ADDRESS(a, bp + size);
+        return bp;
+    }
+    return arena_chunk(a, size);
+}
+
+/*
+ * mm_arena_reset: drop everything allocated from the arena, keeping its current (biggest) chunk for reuse
+ */
+void mm_arena_reset(struct mm_arena *arena)
+{
+    char *a = (char *) arena;
+    char *head;
+    
+    if (!lib_start() || (head = ARENA_CHUNKS(a)) == NULL) {
+        return;
+    }
+    arena_release(CHUNK_LINK(head));
+    PUT_ADDRESS(head, NULL);
+    PUT_ADDRESS(a, head + DSIZE);
+}
+
+/*
+ * mm_arena_destroy: give every chunk and the handle back
+ */
+void mm_arena_destroy(struct mm_arena *arena)
+{
+    if (!lib_start() || arena == NULL) {
+        return;
+    }
+    arena_release(ARENA_CHUNKS((char *) arena));
+    free(arena);
+}
+
+/*
+ * Pools of fixed-size objects, with no header per object.
+ * The handle is a 4-word blk: object size, alignment, list of chunks with free objects and list of full chunks.
+ * A chunk header holds its pool, its free list, the first object never handed out, the number of objects in use
+ * and the links of its chunk list. Freed objects hold the link of the chunk's free list in their first word
+ */
+static size_t POOL_SIZE(char *pl) { return GET(pl); }
+static size_t POOL_ALIGN(char *pl) { return GET(pl + WSIZE); }
+static char *POOL_AVAIL(char *pl) { return GET_ADDRESS(pl + 2*WSIZE); }
+static char *POOL_FULL(char *pl) { return GET_ADDRESS(pl + 3*WSIZE); }
+static char *PCHUNK_FREE(char *c) { return GET_ADDRESS(c + WSIZE); }
+static char *PCHUNK_FRESH(char *c) { return GET_ADDRESS(c + 2*WSIZE); }
+static size_t PCHUNK_USED(char *c) { return GET(c + 3*WSIZE); }
+static char *PCHUNK_NEXT(char *c) { return GET_ADDRESS(c + 4*WSIZE); }
+static char *PCHUNK_PREV(char *c) { return GET_ADDRESS(c + 5*WSIZE); }
+
+static char *pchunk_of(void *ptr)
+{
+    return (char *) ((size_t) ptr & ~(size_t) (POOL_CHUNK - 1));
+}
+
+static bool pchunk_full(char *pl, char *c)     // the last DSIZE bytes of the window hold the next blk's header
+{
+    return PCHUNK_FREE(c) == NULL && PCHUNK_FRESH(c) + POOL_SIZE(pl) > c + POOL_CHUNK - DSIZE;
+}
+
+/*
+ * pchunk_link, pchunk_unlink: put chunk c on, or take it off, the list rooted at word root of the pool handle
+ */
+static void pchunk_link(char *pl, int root, char *c)
+{
+    char *head = GET_ADDRESS(pl + root*WSIZE);
+    
+    PUT_ADDRESS(c + 4*WSIZE, head);
+    PUT_ADDRESS(c + 5*WSIZE, NULL);
+    if (head != NULL) {
+        PUT_ADDRESS(head + 5*WSIZE, c);
+    }
+    PUT_ADDRESS(pl + root*WSIZE, c);
+}
+
+static void pchunk_unlink(char *pl, int root, char *c)
+{
+    char *next = PCHUNK_NEXT(c);
+    char *prev = PCHUNK_PREV(c);
+    
+    if (prev != NULL) {
+        PUT_ADDRESS(prev + 4*WSIZE, next);
+    } else {
+        PUT_ADDRESS(pl + root*WSIZE, next);
+    }
+    if (next != NULL) {
+        PUT_ADDRESS(next + 5*WSIZE, prev);
+    }
+}
+
+/*
+ * pchunk_new: take an aligned chunk from memalign and put it on the avail list, its objects are carved lazily.
+ * The chunk's blk is POOL_CHUNK bytes, or less than 2*DSIZE more when memalign kept a tail too small to free;
+ * objects are only carved from the first POOL_CHUNK bytes, so pchunk_of finds the chunk of any of them
+ */
+static char *pchunk_new(char *pl)
+{
+    char *c = memalign(POOL_CHUNK, POOL_CHUNK - DSIZE);
+    size_t first = (POOL_HDRWORDS*WSIZE + POOL_ALIGN(pl) - 1) & ~(POOL_ALIGN(pl) - 1);
+    
+    if (c == NULL) {
+        return NULL;
+    }
+    PUT_ADDRESS(c, pl);
+    PUT_ADDRESS(c + WSIZE, NULL);
+    PUT_ADDRESS(c + 2*WSIZE, c + first);
+    PUT(c + 3*WSIZE, 0);
+    pchunk_link(pl, 2, c);
+    return c;
+}
+
+/*
+ * mm_pool_create: a pool of objsize-byte objects aligned to alignment, a power of two.
+ * Objects are rounded up to a multiple of alignment and to a word; objects and alignments bigger than
+ * 1/16 of a chunk are refused. The OOBMETA build has no aligned chunks and refuses every pool
+ */
+struct mm_pool *mm_pool_create(size_t objsize, size_t alignment)
+{
+#ifdef OOBMETA
+    return NULL;
+#else
+    char *pl;
+    
+    if (!lib_start()) {
+        return NULL;
+    }
+    if (alignment < WSIZE) {
+        alignment = WSIZE;
+    }
+    if (objsize == 0 || (alignment & (alignment - 1)) != 0 || alignment > POOL_CHUNK / 16 || objsize > POOL_CHUNK / 16) {
+        return NULL;
+    }
+    if ((pl = malloc(4*WSIZE)) == NULL) {
+        return NULL;
+    }
+    PUT(pl, (objsize + alignment - 1) & ~(alignment - 1));
+    PUT(pl + WSIZE, alignment);
+    PUT_ADDRESS(pl + 2*WSIZE, NULL);
+    PUT_ADDRESS(pl + 3*WSIZE, NULL);
+    return (struct mm_pool *) pl;
+#endif
+}
+
+/*
+ * mm_pool_alloc: one object, from the free list of the first chunk with room, else from its untouched tail.
+ * A chunk that runs out moves to the full list
+ */
+void *mm_pool_alloc(struct mm_pool *pool)
+{
+    char *pl = (char *) pool;
+    char *c;
+    char *bp;
+    
+    if (!lib_start()) {
+        return NULL;
+    }
+    if ((c = POOL_AVAIL(pl)) == NULL && (c = pchunk_new(pl)) == NULL) {
+        return NULL;
+    }
+    bp = PCHUNK_FREE(c);
+    if (bp != NULL) {
+        PUT_ADDRESS(c + WSIZE, GET_ADDRESS(bp));
+    } else {
+        bp = PCHUNK_FRESH(c);
+        PUT_ADDRESS(c + 2*WSIZE, bp + POOL_SIZE(pl));
+    }
+    PUT(c + 3*WSIZE, PCHUNK_USED(c) + 1);
+    if (pchunk_full(pl, c)) {
+        pchunk_unlink(pl, 2, c);
+        pchunk_link(pl, 3, c);
+    }
+    return bp;
+}
+
+/*
+ * mm_pool_free: put ptr back on its chunk's free list. A chunk that empties goes back to free,
+ * unless it is the only one with room left
+ */
+void mm_pool_free(struct mm_pool *pool, void *ptr)
+{
+    char *pl = (char *) pool;
+    char *c;
+    
+    if (!lib_start() || ptr == NULL) {
+        return;
+    }
+    c = pchunk_of(ptr);
+    dbg_assert(GET_ADDRESS(c) == pl);
+    if (pchunk_full(pl, c)) {
+        pchunk_unlink(pl, 3, c);
+        pchunk_link(pl, 2, c);
+    }
+    PUT_ADDRESS(ptr, PCHUNK_FREE(c));
+    PUT_ADDRESS(c + WSIZE, ptr);
+    PUT(c + 3*WSIZE, PCHUNK_USED(c) - 1);
+    if (PCHUNK_USED(c) == 0 && (PCHUNK_NEXT(c) != NULL || PCHUNK_PREV(c) != NULL)) {
+        pchunk_unlink(pl, 2, c);
+        free(c);
+    }
+}
+
+/*
+ * mm_pool_destroy: give every chunk and the handle back, whether or not its objects were freed
+ */
+void mm_pool_destroy(struct mm_pool *pool)
+{
+    char *pl = (char *) pool;
+    char *c;
+    
+    if (!lib_start() || pool == NULL) {
+        return;
+    }
+    while ((c = POOL_AVAIL(pl)) != NULL) {
+        pchunk_unlink(pl, 2, c);
+        free(c);
+    }
+    while ((c = POOL_FULL(pl)) != NULL) {
+        pchunk_unlink(pl, 3, c);
+        free(c);
+    }
+    free(pl);
+}
+
 /*
  * Returns whether the pointer is in the heap.
  * May be useful for debugging.
  */
 static bool in_heap(const void* p)
 {
-    return p <= mem_heap_hi() && p >= mem_heap_lo();
+    return mem_region_of(p) >= 0;
 }
 
 /*
@@ -564,7 +3278,9 @@ int getlistNum(size_t size)
  */
 bool mm_checkheap(int lineno)
 {
-#ifdef DEBUG
+#if defined(DEBUG) && defined(OOBMETA)
+    return oob_check(lineno);
+#elif defined(DEBUG)
     /* Write code to check heap invariants here */
     /* IMPLEMENT THIS */
     
@@ -573,50 +3289,78 @@ bool mm_checkheap(int lineno)
     char *bp;
     size_t free_count=0, free_count_heap=0;
     char *current_free_blk;
+    char *firsts[] = {heap_listp,      // first blk of the heap and, with LIFETIME, of the short-lived region
+#ifdef LIFETIME
+                      life_listp,
+#endif
+    };
     
     
     // Is every blk marked as free in seg lists?
     //Do pointers in the free list point to valid free blks?
     
-    for (int i=0; i<SEGLISTNUM; i++){
-         current_free_blk = (char *) GET( list_header_ptr + i*WSIZE ); // let current be the address of first blk in this list
+    for (int i=0; i<ROOTS; i++){
+#ifdef PACKEDBINS
+         char *chunk = GET_ADDRESS( ROOT(i) );
+         for (size_t lane = 0; chunk != NULL; lane + 1 < GET(chunk + WSIZE) ? lane++ : (lane = 0, chunk = GET_ADDRESS(chunk))){   // every used lane holds a free blk
+             current_free_blk = GET_ADDRESS(CHUNK_PTRS(chunk) + lane*WSIZE);
+             if ( GET(N_ADD(current_free_blk)) != (size_t) chunk + lane ){
+                 dbg_printf("Blk %p in bin %d does not know its lane %zu of chunk %p at line %d\n", current_free_blk, i, lane, chunk, lineno);
+                 return false;
+             }
+#else
+         current_free_blk = GET_ADDRESS( ROOT(i) ); // let current be the address of first blk in this list
          while (current_free_blk != NULL){                  // we search through this list to find first fit free blk
+#endif
              free_count = free_count+1;
              if ( GET_ALLOC(HDRP(current_free_blk)) == 1 ){      // if there is a blk which is allocated but still in free list, return false
                  dbg_printf("In seg list %d,  there is a blk is alloced at line %d\n", i, lineno);
                  return false;
              }
-             if ( GET_SIZE(HDRP(current_free_blk)) ==0 || current_free_blk< (char*)mem_heap_lo() || current_free_blk> (char*)mem_heap_hi() ){
+             if ( GET_SIZE(HDRP(current_free_blk)) ==0 || !in_heap(current_free_blk) ){
                  dbg_printf("This pointer:%p is not valid in the free list at line %d\n", current_free_blk, lineno);    // cheak if the free blk pointer is valid or not
                  return false;
              }
+             if ( (LIFE(HDRP(current_free_blk)) != 0) != (i >= SEGLISTNUM) ){
+                 dbg_printf("Blk %p is in seg list %d of the other lifetime class at line %d\n", current_free_blk, i, lineno);
+                 return false;
+             }
              
-             current_free_blk = (char *) GET(N_ADD(current_free_blk)); // let current point to the next blk in this free list
+#ifndef PACKEDBINS
+             current_free_blk = GET_ADDRESS(N_ADD(current_free_blk)); // let current point to the next blk in this free list
+#endif
          }
     }
     
       
     // Is every free blk actually in the free list?
     // Are all blk pointers valid?
-    bp = heap_listp;
+    for (size_t k = 0; k < sizeof(firsts) / sizeof(firsts[0]); k++){
+    bp = firsts[k];
     while ( GET_SIZE(HDRP(bp))>0 ){
       if ( GET_ALLOC(HDRP(bp)) == 0){
           free_count_heap = free_count_heap+1;    // go through the entire heap and count free blks
       }
-      if ( bp< (char*)mem_heap_lo() || bp> (char*)mem_heap_hi() ||bp ==NULL ){
+      if ( !in_heap(bp) ){
           dbg_printf("blk pointer %p is invalid at line %d\n", bp, lineno);    //go through the entire heap to check every blk pointer is valid or not
           return false;
       }
+      if ( (LIFE(HDRP(bp)) != 0) != (k == 1) ){
+          dbg_printf("Blk %p is not of the class of the heap it lies in at line %d\n", bp, lineno);
+          return false;
+      }
     
       bp = NEXT_BLK(bp);
     }
+    }
     if (free_count != free_count_heap){    // compare number of free blks in seglists and number of free blks in heap, if they are not equal, it means there are some free blks are not in seg lists
         dbg_printf("Some free blks is not in seg lists. Free blk in heap:%zu, Free blk in lists:%zu ,at line %d\n", free_count_heap, free_count, lineno);
         return false;
     }
     
     //Are there any free blks escaped from coalescing?
-    bp = heap_listp;
+    for (size_t k = 0; k < sizeof(firsts) / sizeof(firsts[0]); k++){
+    bp = firsts[k];
     while ( GET_SIZE(HDRP(bp))>0 ){
       if ( GET_ALLOC(HDRP(bp)) == 0){    //go through all free blks in heap to check is there is a free blk's previous is free
           if ( PREV_ALLOC(HDRP(bp))!=2 ){
@@ -632,7 +3376,19 @@ bool mm_checkheap(int lineno)
     
       bp = NEXT_BLK(bp);
     }
+    }
     
+#ifdef BUDDY
+    // Is every buddy arena an allocated blk, registered in address order?
+    for (size_t i = 0; buddy_reg != NULL && i < GET(buddy_reg); i++){
+      bp = GET_ADDRESS(buddy_reg + (2 + i)*WSIZE);
+      if ( !GET_ALLOC(HDRP(bp)) || GET_SIZE(HDRP(bp)) != BUDDY_ARENA || BUDDY_USED(bp) >= BUDDY_ARENA
+           || (i > 0 && bp <= GET_ADDRESS(buddy_reg + (1 + i)*WSIZE)) ){
+          dbg_printf("Buddy arena %p is broken or out of order at line %d\n", bp, lineno);
+          return false;
+      }
+    }
+#endif
     
 #endif /* DEBUG */
     return true;
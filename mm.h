@@ -8,6 +8,8 @@ extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
 extern void *mm_calloc (size_t nmemb, size_t size);
+extern void *mm_memalign(size_t alignment, size_t size);
+extern void *mm_malloc_cacheline(size_t size);
 
 #else
 
@@ -16,10 +18,43 @@ extern void *malloc (size_t size);
 extern void free (void *ptr);
 extern void *realloc(void *ptr, size_t size);
 extern void *calloc (size_t nmemb, size_t size);
+extern void *memalign(size_t alignment, size_t size);
+extern void *malloc_cacheline(size_t size);
+extern int posix_memalign(void **memptr, size_t alignment, size_t size);
+extern void *aligned_alloc(size_t alignment, size_t size);
+extern size_t malloc_usable_size(void *ptr);
 
 #endif
 
 extern bool mm_init(void);
 
+/* Back to the state right after mm_init, without redoing it */
+extern bool mm_reset(void);
+
+/* Take over a heap mapped again from its file (mem_remap), only with -DPERSIST */
+extern bool mm_attach(void);
+
+/* Capacity hints: pre-extend the heap, or say how big it is going to get */
+extern bool mm_reserve(size_t bytes);
+extern void mm_hint_peak(size_t bytes);
+
+/* Lifetime hint: a build with -DLIFETIME keeps short-lived blks apart from the others */
+enum mm_lifetime { MM_LIVE_LONG, MM_LIVE_SHORT };
+extern void *mm_malloc_hint(size_t size, int lifetime);
+
+/* Arenas: objects are only given back all together, by mm_arena_reset or mm_arena_destroy */
+struct mm_arena;
+extern struct mm_arena *mm_arena_create(void);
+extern void *mm_arena_malloc(struct mm_arena *arena, size_t size);
+extern void mm_arena_reset(struct mm_arena *arena);
+extern void mm_arena_destroy(struct mm_arena *arena);
+
+/* Pools of fixed-size objects; mm_pool_create returns NULL if the build cannot make them */
+struct mm_pool;
+extern struct mm_pool *mm_pool_create(size_t objsize, size_t alignment);
+extern void *mm_pool_alloc(struct mm_pool *pool);
+extern void mm_pool_free(struct mm_pool *pool, void *ptr);
+extern void mm_pool_destroy(struct mm_pool *pool);
+
 /* This is for debugging.  Returns false if error encountered */
 extern bool mm_checkheap(int lineno);
@@ -0,0 +1,415 @@
+/*
+ * mtdriver.c - multi-threaded replay driver for the thread-safe build of mm.c
+ *
+ * Every thread replays its own copy of a trace (same requests, private
+ * block ids) against one shared heap, so the number of requests per
+ * thread stays fixed while the thread count grows.  For each trace the
+ * driver prints the combined throughput at 1, 2, 4, ... threads and the
+ * speedup over one thread.  Link it with mm.c built with -DMM_THREADS.
+ *
+ * Each block gets its owner's tag in its first byte, which is checked
+ * again before the block is freed, so a block handed to two threads at
+ * once shows up as an error.
+ *
+ * With -S the driver measures false sharing instead: every thread
+ * increments its own counter, allocated either with mm_malloc (counters
+ * packed next to each other) or with mm_malloc_cacheline.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdbool.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "config.h"
+
+/* Misc */
+#define MAXLINE     1024          /* max string size */
+#define MAXTHREADS    64          /* most threads the driver will start */
+#define DEFAULT_REPS  20          /* times each thread replays the trace */
+#define SHARE_INCS  (1 << 24)     /* increments per thread in the -S benchmark */
+#define CACHE_LINE    64
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct {
+    enum { ALLOC, FREE, REALLOC } type; /* type of request */
+    int index;                          /* block id */
+    size_t size;                        /* byte size of alloc/realloc request */
+} traceop_t;
+
+/* Holds the requests of one trace file, shared read-only by all threads */
+typedef struct {
+    char filename[MAXLINE];
+    int num_ids;          /* number of alloc/realloc ids */
+    int num_ops;          /* number of requests */
+    traceop_t *ops;       /* array of requests */
+} trace_t;
+
+/* Parameters and results of one replay thread */
+typedef struct {
+    pthread_t tid;
+    const trace_t *trace;
+    int reps;
+    unsigned char tag;    /* written to the first byte of every block */
+    long errors;          /* blocks that did not keep their tag */
+} worker_t;
+
+static char *default_tracefiles[] = {
+    "ngram-shake1.rep", "bdd-aa32.rep", "cbit-parity.rep", NULL
+};
+
+/* One thread of the -S benchmark */
+typedef struct {
+    pthread_t tid;
+    volatile long *counter;
+} sharer_t;
+
+static void usage(char *prog);
+static void app_error(const char *fmt, ...)
+    __attribute__((format(printf, 1,2), noreturn));
+
+/*
+ * read_trace - read a trace file in the format of mdriver
+ */
+static trace_t *read_trace(const char *filename)
+{
+    FILE *tracefile;
+    trace_t *trace;
+    char type[MAXLINE];
+    int weight, op_index = 0;
+    size_t data_bytes;
+
+    if ((trace = malloc(sizeof(trace_t))) == NULL)
+        app_error("malloc failed in read_trace");
+    snprintf(trace->filename, MAXLINE, "%s", filename);
+    if ((tracefile = fopen(filename, "r")) == NULL)
+        app_error("Could not open %s in read_trace", filename);
+    if (fscanf(tracefile, "%d %d %d %zu", &weight, &trace->num_ids,
+               &trace->num_ops, &data_bytes) != 4)
+        app_error("%s: bad trace header", filename);
+    if ((trace->ops = malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+        app_error("malloc failed in read_trace");
+
+    while (op_index < trace->num_ops && fscanf(tracefile, "%s", type) != EOF) {
+        traceop_t *op = &trace->ops[op_index];
+        int ok;
+        switch (type[0]) {
+            case 'a':
+                op->type = ALLOC;
+                ok = fscanf(tracefile, "%d %zu", &op->index, &op->size) == 2;
+                break;
+            case 'r':
+                op->type = REALLOC;
+                ok = fscanf(tracefile, "%d %zu", &op->index, &op->size) == 2;
+                break;
+            case 'f':
+                op->type = FREE;
+                ok = fscanf(tracefile, "%d", &op->index) == 1;
+                break;
+            default:
+                ok = false;
+        }
+        if (!ok || op->index < 0 || op->index >= trace->num_ids)
+            app_error("%s: bad request on line %d", filename, op_index + 5);
+        op_index++;
+    }
+    fclose(tracefile);
+    trace->num_ops = op_index;
+    return trace;
+}
+
+static void free_trace(trace_t *trace)
+{
+    free(trace->ops);
+    free(trace);
+}
+
+/*
+ * check_tag - count a block whose first byte is not its owner's tag
+ */
+static void check_tag(worker_t *w, const char *p, size_t size)
+{
+    if (size > 0 && (unsigned char) *p != w->tag)
+        w->errors++;
+}
+
+/*
+ * replay - thread body: run the trace reps times on private block ids
+ */
+static void *replay(void *arg)
+{
+    worker_t *w = arg;
+    const trace_t *trace = w->trace;
+    char **blocks = calloc(trace->num_ids, sizeof(char *));
+    size_t *sizes = calloc(trace->num_ids, sizeof(size_t));
+    int rep, i;
+
+    if (blocks == NULL || sizes == NULL)
+        app_error("calloc failed in replay");
+
+    for (rep = 0; rep < w->reps; rep++) {
+        for (i = 0; i < trace->num_ops; i++) {
+            const traceop_t *op = &trace->ops[i];
+            char *p;
+            switch (op->type) {
+                case ALLOC:
+                    p = mm_malloc(op->size);
+                    if (p == NULL && op->size > 0)
+                        app_error("mm_malloc failed");
+                    if (op->size > 0)
+                        *p = w->tag;
+                    blocks[op->index] = p;
+                    sizes[op->index] = op->size;
+                    break;
+                case REALLOC:
+                    if (blocks[op->index] != NULL)
+                        check_tag(w, blocks[op->index], sizes[op->index]);
+                    p = mm_realloc(blocks[op->index], op->size);
+                    if (p == NULL && op->size > 0)
+                        app_error("mm_realloc failed");
+                    if (op->size > 0)
+                        *p = w->tag;
+                    blocks[op->index] = p;
+                    sizes[op->index] = op->size;
+                    break;
+                case FREE:
+                    if (blocks[op->index] != NULL)
+                        check_tag(w, blocks[op->index], sizes[op->index]);
+                    mm_free(blocks[op->index]);
+                    blocks[op->index] = NULL;
+                    break;
+            }
+        }
+        for (i = 0; i < trace->num_ids; i++) {   /* traces may leave blocks allocated */
+            mm_free(blocks[i]);
+            blocks[i] = NULL;
+        }
+    }
+    free(blocks);
+    free(sizes);
+    return NULL;
+}
+
+/*
+ * run_threads - replay trace on nthreads threads, return elapsed seconds
+ */
+static double run_threads(const trace_t *trace, int nthreads, int reps, long *errors)
+{
+    worker_t workers[MAXTHREADS];
+    struct timespec start, end;
+    int i;
+
+    mem_reset_brk();
+    if (!mm_init())
+        app_error("mm_init failed");
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nthreads; i++) {
+        workers[i].trace = trace;
+        workers[i].reps = reps;
+        workers[i].tag = (unsigned char) (0xA5 + i);
+        workers[i].errors = 0;
+        if ((errno = pthread_create(&workers[i].tid, NULL, replay, &workers[i])) != 0)
+            app_error("pthread_create failed: %s", strerror(errno));
+    }
+    for (i = 0; i < nthreads; i++)
+        pthread_join(workers[i].tid, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    for (i = 0; i < nthreads; i++)
+        *errors += workers[i].errors;
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+/*
+ * share - thread body of the -S benchmark
+ */
+static void *share(void *arg)
+{
+    volatile long *counter = ((sharer_t *) arg)->counter;
+    long i;
+
+    for (i = 0; i < SHARE_INCS; i++)
+        (*counter)++;
+    return NULL;
+}
+
+/*
+ * run_share - give nthreads threads one counter each and time their
+ *    increments, return ns per increment; *lines is set to the number of
+ *    distinct cache lines the counters live in
+ */
+static double run_share(int nthreads, bool cacheline, int *lines)
+{
+    sharer_t sharers[MAXTHREADS];
+    struct timespec start, end;
+    int i, j;
+
+    mem_reset_brk();
+    if (!mm_init())
+        app_error("mm_init failed");
+    *lines = 0;
+    for (i = 0; i < nthreads; i++) {
+        long *p = cacheline ? mm_malloc_cacheline(sizeof(long)) : mm_malloc(sizeof(long));
+        if (p == NULL)
+            app_error("allocation failed in run_share");
+        *p = 0;
+        sharers[i].counter = p;
+        for (j = 0; j < i; j++)
+            if ((size_t) sharers[j].counter / CACHE_LINE == (size_t) p / CACHE_LINE)
+                break;
+        *lines += (j == i);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nthreads; i++)
+        if ((errno = pthread_create(&sharers[i].tid, NULL, share, &sharers[i])) != 0)
+            app_error("pthread_create failed: %s", strerror(errno));
+    for (i = 0; i < nthreads; i++)
+        pthread_join(sharers[i].tid, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    for (i = 0; i < nthreads; i++) {
+        if (*sharers[i].counter != SHARE_INCS)
+            app_error("counter %d lost increments", i);
+        mm_free((void *) sharers[i].counter);
+    }
+    return ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec))
+        / ((double) nthreads * SHARE_INCS);
+}
+
+/*
+ * eval_share - the -S benchmark, packed and cache-line counters side by side
+ */
+static void eval_share(int max_threads)
+{
+    int n, lines, cl_lines;
+    double packed, cl;
+
+    mem_init();
+    printf("%8s %18s %8s %18s %8s\n", "threads", "mm_malloc ns/inc", "lines",
+           "cacheline ns/inc", "lines");
+    for (n = 1; n <= max_threads; n = (n * 2 > max_threads && n < max_threads) ? max_threads : n * 2) {
+        packed = run_share(n, false, &lines);
+        cl = run_share(n, true, &cl_lines);
+        printf("%8d %18.2f %8d %18.2f %8d\n", n, packed, lines, cl, cl_lines);
+    }
+    mem_deinit();
+}
+
+int main(int argc, char **argv)
+{
+    char tracedir[MAXLINE] = TRACEDIR;
+    char path[2 * MAXLINE];
+    char **tracefiles = NULL;
+    int num_tracefiles = 0;
+    int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int reps = DEFAULT_REPS;
+    bool sharing = false;
+    long errors = 0;
+    int c, i, n;
+
+    while ((c = getopt(argc, argv, "f:n:r:t:Sh")) != EOF) {
+        switch (c) {
+            case 'f': /* Use a specific trace file (relative to curr dir) */
+                tracefiles = realloc(tracefiles, (num_tracefiles + 1) * sizeof(char *));
+                tracefiles[num_tracefiles++] = optarg;
+                strcpy(tracedir, "");
+                break;
+            case 'n': /* Largest number of threads */
+                max_threads = atoi(optarg);
+                break;
+            case 'r': /* Replays of the trace per thread */
+                reps = atoi(optarg);
+                break;
+            case 't': /* Directory where the traces are located */
+                snprintf(tracedir, MAXLINE, "%s/", optarg);
+                break;
+            case 'S': /* False sharing benchmark instead of the traces */
+                sharing = true;
+                break;
+            case 'h':
+                usage(argv[0]);
+                exit(0);
+            default:
+                usage(argv[0]);
+                exit(1);
+        }
+    }
+    if (max_threads < 1)
+        max_threads = 1;
+    if (max_threads > MAXTHREADS)
+        max_threads = MAXTHREADS;
+    if (sharing) {
+        eval_share(max_threads);
+        exit(0);
+    }
+    if (num_tracefiles == 0) {
+        tracefiles = default_tracefiles;
+        while (tracefiles[num_tracefiles] != NULL)
+            num_tracefiles++;
+    }
+
+    mem_init();
+    printf("%-28s %8s %10s %8s\n", "trace", "threads", "Kops", "speedup");
+    for (i = 0; i < num_tracefiles; i++) {
+        trace_t *trace;
+        double base = 0;
+
+        snprintf(path, sizeof(path), "%s%s", tracedir, tracefiles[i]);
+        trace = read_trace(path);
+        run_threads(trace, max_threads, 1, &errors);   /* untimed: fault in the heap pages first */
+        for (n = 1; n <= max_threads; n = (n * 2 > max_threads && n < max_threads) ? max_threads : n * 2) {
+            double secs = run_threads(trace, n, reps, &errors);
+            double kops = (double) n * reps * trace->num_ops / secs / 1000.0;
+            if (n == 1)
+                base = kops;
+            printf("%-28s %8d %10.0f %7.2fx\n", tracefiles[i], n, kops, kops / base);
+        }
+        free_trace(trace);
+    }
+    mem_deinit();
+
+    if (errors != 0) {
+        printf("ERROR: %ld blocks were overwritten by another thread\n", errors);
+        exit(1);
+    }
+    exit(0);
+}
+
+/*
+ * app_error - Report an arbitrary application error
+ */
+static void app_error(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    fprintf(stderr, "ERROR: ");
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    exit(1);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(char *prog)
+{
+    fprintf(stderr, "Usage: %s [-hS] [-n <threads>] [-r <reps>] [-t <dir>] [-f <file>]\n", prog);
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-f <file>  Use <file> as a trace file (may be repeated).\n");
+    fprintf(stderr, "\t-n <n>     Run with 1, 2, 4, ... up to <n> threads (default: online cpus).\n");
+    fprintf(stderr, "\t-r <reps>  Each thread replays the trace <reps> times (default %d).\n", DEFAULT_REPS);
+    fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-S         Time per-thread counters, packed vs. one cache line each.\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+}